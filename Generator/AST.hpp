@@ -1,17 +1,88 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <vector>
 
 #include "Generator/ValueType.hpp"
+#include "Generator/Value.hpp"
+#include "Util/Arena.hpp"
 #include "Util/EnumHelpers.hpp"
 
 namespace Lua {
 
+/*
+ * Every node of a parse lives in this arena, the tree is released in one
+ * go by clearing it once code has been generated.
+ */
+inline MonotonicArena & astArena()
+{
+	static MonotonicArena arena;
+	return arena;
+}
+
+template <typename T, typename... Args>
+T * make(Args &&... args)
+{
+	return astArena().create<T>(std::forward<Args>(args)...);
+}
+
+// Contiguous list of child nodes, grown inside the AST arena while parsing
+template <typename T>
+class NodeList {
+public:
+	T * const * begin() const { return m_data; }
+	T * const * end() const { return m_data + m_size; }
+	T ** begin() { return m_data; }
+	T ** end() { return m_data + m_size; }
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	T * operator [] (size_t i) const { return m_data[i]; }
+	T *& operator [] (size_t i) { return m_data[i]; }
+
+	void append(T *n)
+	{
+		if (m_size == m_capacity) {
+			// The old array stays behind in the arena, at most as much as the list itself
+			uint32_t capacity = m_capacity ? m_capacity * 2 : 4;
+			T **data = astArena().allocateArray<T *>(capacity);
+			std::copy(begin(), end(), data);
+			m_data = data;
+			m_capacity = capacity;
+		}
+		m_data[m_size++] = n;
+	}
+
+	// Keeps the first count elements, for passes that drop children
+	void truncate(size_t count)
+	{
+		assert(count <= m_size);
+		m_size = count;
+	}
+
+	template <typename Predicate>
+	void removeIf(Predicate pred)
+	{
+		truncate(std::remove_if(begin(), end(), pred) - begin());
+	}
+
+private:
+	T **m_data = nullptr;
+	uint32_t m_size = 0;
+	uint32_t m_capacity = 0;
+};
+
+/*
+ * Nodes carry their type instead of a vtable, print() and the code walking
+ * the tree dispatch on it.
+ */
 class Node {
 public:
 	enum class Type {
@@ -29,74 +100,71 @@ public:
 		_last,
 	};
 
-	virtual void append(Node *n) { assert(false); }
-
-	virtual void print(int indent = 0) const
-	{
-		do_indent(indent);
-		std::cout << "Node\n";
-	}
-
-	Node() = default;
-	virtual ~Node() = default;
-	Node(Node &&) = default;
+	void print(int indent = 0) const;
 
-	virtual bool isValue() const { return false; }
+	bool isValue() const { return m_type == Type::Value; }
 
 	Node(const Node &) = delete;
 	Node & operator = (const Node &) = delete;
-	Node & operator = (Node &&) = default;
 
-	virtual Type type() const = 0;
+	Type type() const { return m_type; }
 
 protected:
-	void do_indent(int indent) const
+	explicit Node(Type type) : m_type{type} {}
+	~Node() = default;
+
+	static void do_indent(int indent)
 	{
 		for (int i = 0; i < indent; ++i)
 			std::cout << '\t';
 	}
+
+private:
+	Type m_type;
 };
 
 class Chunk : public Node {
 public:
-	void append(Node *n) override { m_children.emplace_back(n); }
+	Chunk() : Node{Type::Chunk} {}
+
+	void append(Node *n) { m_children.append(n); }
 
-	const std::vector <std::unique_ptr <Node> > & children() const { return m_children; }
+	const NodeList <Node> & children() const { return m_children; }
+	NodeList <Node> & children() { return m_children; }
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Chunk:\n";
-		for (const auto &n : m_children)
+		for (const Node *n : m_children)
 			n->print(indent + 1);
 	}
 
-	Node::Type type() const override { return Type::Chunk; }
-
 private:
-	std::vector <std::unique_ptr <Node> > m_children;
+	NodeList <Node> m_children;
 };
 
 class ExprList : public Node {
 public:
-	void append(Node *n) override { m_exprs.emplace_back(n); }
+	ExprList() : Node{Type::ExprList} {}
+
+	void append(Node *n) { m_exprs.append(n); }
 
-	const std::vector <std::unique_ptr <Node> > & exprs() const { return m_exprs; }
+	const NodeList <Node> & exprs() const { return m_exprs; }
+	NodeList <Node> & exprs() { return m_exprs; }
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Expression list: [\n";
-		for (const auto &n : m_exprs)
+		for (const Node *n : m_exprs)
 			n->print(indent + 1);
 		do_indent(indent);
 		std::cout << "]\n";
 	}
 
-	Node::Type type() const override { return Type::ExprList; }
-
 private:
-	std::vector <std::unique_ptr <Node> > m_exprs;
+	NodeList <Node> m_exprs;
 };
 
 class LValue : public Node {
@@ -107,11 +175,11 @@ public:
 		Name,
 	};
 
-	LValue(Node *tableExpr, Node *keyExpr) : m_type{Type::Bracket}, m_tableExpr{tableExpr}, m_keyExpr{keyExpr} {}
-	LValue(Node *tableExpr, const char *fieldName) : m_type{Type::Dot}, m_tableExpr{tableExpr}, m_name{fieldName} {}
-	LValue(const char *varName) : m_type{Type::Name}, m_name{varName} {}
+	LValue(Node *tableExpr, Node *keyExpr) : Node{Node::Type::LValue}, m_type{Type::Bracket}, m_tableExpr{tableExpr}, m_keyExpr{keyExpr} {}
+	LValue(Node *tableExpr, Atom fieldName) : Node{Node::Type::LValue}, m_type{Type::Dot}, m_tableExpr{tableExpr}, m_keyExpr{nullptr}, m_name{fieldName} {}
+	LValue(Atom varName) : Node{Node::Type::LValue}, m_type{Type::Name}, m_tableExpr{nullptr}, m_keyExpr{nullptr}, m_name{varName} {}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "LValue";
@@ -135,57 +203,65 @@ public:
 		}
 	}
 
-	const std::string & name() const { return m_name; }
-	const Node * tableExpr() const { return m_tableExpr.get(); }
-	const Node * keyExpr() const { return m_keyExpr.get(); }
+	Atom name() const { return m_name; }
+	const Node * tableExpr() const { return m_tableExpr; }
+	const Node * keyExpr() const { return m_keyExpr; }
+	Node *& mutableTableExpr() { return m_tableExpr; }
+	Node *& mutableKeyExpr() { return m_keyExpr; }
 
 	Type lvalueType() const { return m_type; }
-	Node::Type type() const override { return Node::Type::LValue; }
 private:
 	Type m_type;
-	std::unique_ptr <Node> m_tableExpr;
-	std::unique_ptr <Node> m_keyExpr;
-	std::string m_name;
+	Node *m_tableExpr;
+	Node *m_keyExpr;
+	Atom m_name;
 };
 
 class VarList : public Node {
 public:
+	VarList() : Node{Type::VarList} {}
+
 	void append(LValue *lval)
 	{
-		m_vars.emplace_back(lval);
+		m_vars.append(lval);
+	}
+
+	const NodeList <LValue> & vars() const
+	{
+		return m_vars;
 	}
 
-	const std::vector <std::unique_ptr <LValue> > & vars() const
+	NodeList <LValue> & vars()
 	{
 		return m_vars;
 	}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Variable list: [\n";
-		for (const auto &lv : m_vars) {
+		for (const LValue *lv : m_vars) {
 			lv->print(indent + 1);
 		}
 		do_indent(indent);
 		std::cout << "]\n";
 	}
 
-	Node::Type type() const override { return Type::VarList; }
-
 private:
-	std::vector <std::unique_ptr <LValue> > m_vars;
+	NodeList <LValue> m_vars;
 };
 
 class Assignment : public Node {
 public:
-	Assignment(VarList *vl, ExprList *el) : m_varList{vl}, m_exprList{el} {}
+	Assignment(VarList *vl, ExprList *el) : Node{Type::Assignment}, m_varList{vl}, m_exprList{el} {}
 
-	const VarList * varList() const { return m_varList.get(); }
+	const VarList * varList() const { return m_varList; }
+	VarList * varList() { return m_varList; }
 
-	const ExprList * exprList() const { return m_exprList.get(); }
+	const ExprList * exprList() const { return m_exprList; }
+	ExprList * exprList() { return m_exprList; }
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Assignment:\n";
@@ -193,45 +269,45 @@ public:
 		m_exprList->print(indent + 1);
 	}
 
-	Node::Type type() const override { return Type::Assignment; }
-
 private:
-	std::unique_ptr <VarList> m_varList;
-	std::unique_ptr <ExprList> m_exprList;
+	VarList *m_varList;
+	ExprList *m_exprList;
 };
 
 class Value : public Node {
 public:
-	bool isValue() const override { return true; }
+	void print(int indent) const;
 
-	Node::Type type() const override { return Type::Value; }
+	ValueType valueType() const { return m_valueType; }
 
-	virtual ValueType valueType() const = 0;
+protected:
+	explicit Value(ValueType vt) : Node{Type::Value}, m_valueType{vt} {}
+
+private:
+	ValueType m_valueType;
 };
 
 class NilValue : public Value {
 public:
-	void print(int indent) const override
+	NilValue() : Value{ValueType::Nil} {}
+
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "nil\n";
 	}
-
-	ValueType valueType() const override { return ValueType::Nil; }
 };
 
 class BooleanValue : public Value {
 public:
-	BooleanValue(bool v) : m_value{v} {}
+	BooleanValue(bool v) : Value{ValueType::Boolean}, m_value{v} {}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << std::boolalpha << m_value << '\n';
 	}
 
-	ValueType valueType() const override { return ValueType::Boolean; }
-
 	bool value() const { return m_value; }
 private:
 	bool m_value;
@@ -239,26 +315,40 @@ private:
 
 class StringValue : public Value {
 public:
-	StringValue(const char *v) : m_value{v} {}
+	StringValue(Atom v) : Value{ValueType::String}, m_value{v} {}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "String: " << m_value << '\n';
 	}
 
-	ValueType valueType() const override { return ValueType::String; }
+	Atom value() const { return m_value; }
+private:
+	Atom m_value;
+};
+
+// Table built at compile time from a constructor with constant fields
+class TableValue : public Value {
+public:
+	TableValue(Table *table) : Value{ValueType::Table}, m_value{table} {}
+
+	void print(int indent) const
+	{
+		do_indent(indent);
+		std::cout << "Prebuilt table\n";
+	}
 
-	const std::string & value() const { return m_value; }
+	Table * value() const { return m_value; }
 private:
-	std::string m_value;
+	Table *m_value;
 };
 
 class FunctionCall : public Node {
 public:
-	FunctionCall(Node *funcExpr, ExprList *args) : m_functionExpr{funcExpr}, m_args{args} {}
+	FunctionCall(Node *funcExpr, ExprList *args) : Node{Type::FunctionCall}, m_functionExpr{funcExpr}, m_args{args} {}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Function call:\n";
@@ -268,28 +358,27 @@ public:
 		m_args->print(indent + 1);
 	}
 
-	const Node * functionExpr() const { return m_functionExpr.get(); }
+	const Node * functionExpr() const { return m_functionExpr; }
+	Node *& mutableFunctionExpr() { return m_functionExpr; }
 
-	const ExprList * args() const { return m_args.get(); }
+	const ExprList * args() const { return m_args; }
+	ExprList * args() { return m_args; }
 
-	Node::Type type() const override { return Type::FunctionCall; }
 private:
-	std::unique_ptr <Node> m_functionExpr;
-	std::unique_ptr <ExprList> m_args;
+	Node *m_functionExpr;
+	ExprList *m_args;
 };
 
 class IntValue : public Value {
 public:
-	constexpr IntValue(int v) : m_value{v} {}
+	IntValue(int v) : Value{ValueType::Integer}, m_value{v} {}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Int: " << m_value << '\n';
 	}
 
-	ValueType valueType() const override { return ValueType::Integer; }
-
 	int value() const { return m_value; }
 private:
 	int m_value;
@@ -297,16 +386,14 @@ private:
 
 class RealValue : public Value {
 public:
-	constexpr RealValue(double v) : m_value{v} {}
+	RealValue(double v) : Value{ValueType::Real}, m_value{v} {}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Real: " << m_value << '\n';
 	}
 
-	ValueType valueType() const override { return ValueType::Real; }
-
 	double value() const { return m_value; }
 private:
 	double m_value;
@@ -320,11 +407,11 @@ public:
 		NoIndex,
 	};
 
-	Field(Node *expr, Node *val) : m_type{Type::Brackets}, m_keyExpr{expr}, m_valueExpr{val} {}
-	Field(const std::string &s, Node *val) : m_type{Type::Literal}, m_fieldName{s}, m_valueExpr{val} {}
-	Field(Node *val) : m_type{Type::NoIndex}, m_keyExpr{nullptr}, m_valueExpr{val} {}
+	Field(Node *expr, Node *val) : Node{Node::Type::Field}, m_type{Type::Brackets}, m_keyExpr{expr}, m_valueExpr{val} {}
+	Field(Atom s, Node *val) : Node{Node::Type::Field}, m_type{Type::Literal}, m_fieldName{s}, m_keyExpr{nullptr}, m_valueExpr{val} {}
+	Field(Node *val) : Node{Node::Type::Field}, m_type{Type::NoIndex}, m_keyExpr{nullptr}, m_valueExpr{val} {}
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		switch (m_type) {
@@ -347,36 +434,38 @@ public:
 
 	Type fieldType() const { return m_type; }
 
-	Node::Type type() const override { return Node::Type::Field; }
-
-	const std::string & fieldName() const { return m_fieldName; }
-	const Node * keyExpr() const { return m_keyExpr.get(); }
-	const Node * valueExpr() const { return m_valueExpr.get(); }
+	Atom fieldName() const { return m_fieldName; }
+	const Node * keyExpr() const { return m_keyExpr; }
+	const Node * valueExpr() const { return m_valueExpr; }
+	Node *& mutableKeyExpr() { return m_keyExpr; }
+	Node *& mutableValueExpr() { return m_valueExpr; }
 
 private:
 	Type m_type;
-	std::string m_fieldName;
-	std::unique_ptr <Node> m_keyExpr;
-	std::unique_ptr <Node> m_valueExpr;
+	Atom m_fieldName;
+	Node *m_keyExpr;
+	Node *m_valueExpr;
 };
 
 class TableCtor : public Node {
 public:
-	void append(Field *f) { m_fields.emplace_back(f); }
+	TableCtor() : Node{Node::Type::TableCtor} {}
+
+	void append(Field *f) { m_fields.append(f); }
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "Table:\n";
-		for (const auto &p : m_fields)
+		for (const Field *p : m_fields)
 			p->print(indent + 1);
 	}
 
-	const std::vector <std::unique_ptr <Field> > & fields() const { return m_fields; }
+	const NodeList <Field> & fields() const { return m_fields; }
+	NodeList <Field> & fields() { return m_fields; }
 
-	Node::Type type() const override { return Node::Type::TableCtor; }
 private:
-	std::vector <std::unique_ptr <Field> > m_fields;
+	NodeList <Field> m_fields;
 };
 
 class BinOp : public Node {
@@ -399,7 +488,7 @@ public:
 		_last
 	};
 
-	BinOp(Type t, Node *left, Node *right) : m_type{t}, m_left{left}, m_right{right} {}
+	BinOp(Type t, Node *left, Node *right) : Node{Node::Type::BinOp}, m_type{t}, m_left{left}, m_right{right} {}
 
 	static const std::vector <ValueType> & applicableTypes(Type t)
 	{
@@ -410,6 +499,7 @@ public:
 				result[toUnderlying(v)] = {ValueType::Integer, ValueType::Real};
 
 			result[toUnderlying(Type::Modulo)] = {ValueType::Integer};
+			result[toUnderlying(Type::Concat)] = {ValueType::String};
 
 			return result;
 		}();
@@ -431,10 +521,12 @@ public:
 
 	Type binOpType() const { return m_type; }
 
-	const Node * left() const { return m_left.get(); }
-	const Node * right() const { return m_right.get(); }
+	const Node * left() const { return m_left; }
+	const Node * right() const { return m_right; }
+	Node *& mutableLeft() { return m_left; }
+	Node *& mutableRight() { return m_right; }
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "BinOp: " << toString() << '\n';
@@ -442,14 +534,12 @@ public:
 		m_right->print(indent + 1);
 	}
 
-	Node::Type type() const override { return Node::Type::BinOp; }
-
 	const char * toString() const { return toString(m_type); }
 
 private:
 	Type m_type;
-	std::unique_ptr <Node> m_left;
-	std::unique_ptr <Node> m_right;
+	Node *m_left;
+	Node *m_right;
 };
 
 class UnOp : public Node {
@@ -460,7 +550,7 @@ public:
 		Length,
 	};
 
-	UnOp(Type t, Node *op) : m_type{t}, m_operand{op} {}
+	UnOp(Type t, Node *op) : Node{Node::Type::UnOp}, m_type{t}, m_operand{op} {}
 
 	static const char * toString(Type t)
 	{
@@ -470,22 +560,92 @@ public:
 
 	Type unOpType() const { return m_type; }
 
-	Node * operand() const { return m_operand.get(); }
+	const Node * operand() const { return m_operand; }
+	Node *& mutableOperand() { return m_operand; }
 
-	void print(int indent) const override
+	void print(int indent) const
 	{
 		do_indent(indent);
 		std::cout << "UnOp: " << toString() << '\n';
 		m_operand->print(indent + 1);
 	}
 
-	Node::Type type() const override { return Node::Type::UnOp; }
-
 	const char * toString() const { return toString(m_type); }
 
 private:
 	Type m_type;
-	std::unique_ptr <Node> m_operand;
+	Node *m_operand;
 };
 
+inline void Node::print(int indent) const
+{
+	switch (m_type) {
+		case Type::Chunk:
+			static_cast<const Chunk *>(this)->print(indent);
+			break;
+		case Type::ExprList:
+			static_cast<const ExprList *>(this)->print(indent);
+			break;
+		case Type::VarList:
+			static_cast<const VarList *>(this)->print(indent);
+			break;
+		case Type::LValue:
+			static_cast<const LValue *>(this)->print(indent);
+			break;
+		case Type::FunctionCall:
+			static_cast<const FunctionCall *>(this)->print(indent);
+			break;
+		case Type::Assignment:
+			static_cast<const Assignment *>(this)->print(indent);
+			break;
+		case Type::Value:
+			static_cast<const Value *>(this)->print(indent);
+			break;
+		case Type::TableCtor:
+			static_cast<const TableCtor *>(this)->print(indent);
+			break;
+		case Type::Field:
+			static_cast<const Field *>(this)->print(indent);
+			break;
+		case Type::BinOp:
+			static_cast<const BinOp *>(this)->print(indent);
+			break;
+		case Type::UnOp:
+			static_cast<const UnOp *>(this)->print(indent);
+			break;
+		default:
+			do_indent(indent);
+			std::cout << "Node\n";
+			break;
+	}
+}
+
+inline void Value::print(int indent) const
+{
+	switch (m_valueType) {
+		case ValueType::Nil:
+			static_cast<const NilValue *>(this)->print(indent);
+			break;
+		case ValueType::Boolean:
+			static_cast<const BooleanValue *>(this)->print(indent);
+			break;
+		case ValueType::Integer:
+			static_cast<const IntValue *>(this)->print(indent);
+			break;
+		case ValueType::Real:
+			static_cast<const RealValue *>(this)->print(indent);
+			break;
+		case ValueType::String:
+			static_cast<const StringValue *>(this)->print(indent);
+			break;
+		case ValueType::Table:
+			static_cast<const TableValue *>(this)->print(indent);
+			break;
+		default:
+			do_indent(indent);
+			std::cout << "Value\n";
+			break;
+	}
+}
+
 } //namespace Lua
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "Generator/Atom.hpp"
+
+struct Atom::Storage {
+	// Keys view the strings of the entries
+	std::unordered_map <std::string_view, Entry *> table;
+	// Entries made by runtime(), some may have been interned by the compiler since
+	std::vector <Entry *> collectable;
+	bool allocateMarked = false;
+};
+
+Atom::Atom()
+{
+	static const Entry *empty = intern({}, false);
+	m_entry = empty;
+}
+
+Atom::Atom(std::string_view s) : m_entry{intern(s, false)} {}
+
+Atom Atom::runtime(std::string_view s)
+{
+	return Atom{intern(s, true)};
+}
+
+Atom::Storage & Atom::storage()
+{
+	static Storage storage;
+	return storage;
+}
+
+const Atom::Entry * Atom::intern(std::string_view s, bool collectable)
+{
+	Storage &st = storage();
+
+	auto iter = st.table.find(s);
+	if (iter != st.table.end()) {
+		// The compiler may hold on to it where the Collector doesn't look
+		if (!collectable)
+			iter->second->collectable = false;
+		return iter->second;
+	}
+
+	Entry *entry = new Entry{std::string{s}, std::hash<std::string_view>{}(s), collectable, st.allocateMarked};
+	st.table.emplace(entry->str, entry);
+	if (collectable)
+		st.collectable.push_back(entry);
+	return entry;
+}
+
+void Atom::startMark()
+{
+	storage().allocateMarked = true;
+}
+
+size_t Atom::sweep()
+{
+	Storage &st = storage();
+	size_t live = 0;
+	size_t freed = 0;
+
+	for (Entry *entry : st.collectable) {
+		if (!entry->collectable)
+			continue;
+
+		if (entry->marked) {
+			entry->marked = false;
+			st.collectable[live++] = entry;
+		} else {
+			st.table.erase(entry->str);
+			delete entry;
+			++freed;
+		}
+	}
+
+	st.collectable.resize(live);
+	st.allocateMarked = false;
+	return freed;
+}
+
+Atom operator + (const Atom &left, const Atom &right)
+{
+	return Atom{left.str() + right.str()};
+}
+
+std::ostream & operator << (std::ostream &os, const Atom &a)
+{
+	os << a.str();
+	return os;
+}
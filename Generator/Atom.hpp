@@ -0,0 +1,73 @@
+#pragma once
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+/*
+ * Interned string. Every distinct string is stored once in a global table
+ * together with its hash, so an Atom is a single pointer: equality is a
+ * pointer compare and hashing never touches the characters.
+ *
+ * Strings interned by the compiler (identifiers, literals, folded constants)
+ * live until the process exits. Strings built by the running code come from
+ * runtime() and are freed by the Collector once nothing references them,
+ * unless the compiler interns the same string too.
+ */
+class Atom {
+public:
+	Atom();
+	explicit Atom(std::string_view s);
+	static Atom runtime(std::string_view s);
+
+	const std::string & str() const { return m_entry->str; }
+	const char * c_str() const { return m_entry->str.c_str(); }
+	size_t size() const { return m_entry->str.size(); }
+	size_t hash() const { return m_entry->hash; }
+
+	// Opaque pointer identifying the atom, used by NaN-boxed values
+	const void * handle() const { return m_entry; }
+	static Atom fromHandle(const void *handle) { return Atom{static_cast<const Entry *>(handle)}; }
+
+	bool operator == (const Atom &other) const { return m_entry == other.m_entry; }
+	bool operator != (const Atom &other) const { return m_entry != other.m_entry; }
+	// Pointer order, only meaningful within a single run
+	bool operator < (const Atom &other) const { return m_entry < other.m_entry; }
+
+	bool collectable() const { return m_entry->collectable; }
+
+	// Used by the Collector: strings made after startMark() are kept by the next sweep(),
+	// the others only when marked
+	static void startMark();
+	void mark() const { m_entry->marked = true; }
+	static size_t sweep();
+
+private:
+	struct Entry {
+		std::string str;
+		size_t hash;
+		bool collectable;
+		mutable bool marked;
+	};
+	struct Storage;
+
+	explicit Atom(const Entry *entry) : m_entry{entry} {}
+
+	static Storage & storage();
+	static const Entry * intern(std::string_view s, bool collectable);
+
+	const Entry *m_entry;
+};
+
+Atom operator + (const Atom &left, const Atom &right);
+std::ostream & operator << (std::ostream &os, const Atom &a);
+
+namespace std {
+
+template <>
+struct hash <Atom> {
+	size_t operator () (const Atom &a) const { return a.hash(); }
+};
+
+} //namespace std
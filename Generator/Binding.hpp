@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+
+#include "Generator/Builtins.hpp"
+#include "Generator/RValue.hpp"
+#include "Util/PrettyPrint.hpp"
+
+/*
+ * Binds an ordinary C++ function as a builtin: bind<f>("name") generates the
+ * glue that unboxes the arguments, checks their types and boxes the result,
+ * and records the typed signature the generator uses to call f directly.
+ * Supported parameter types are int, double (Integers are promoted), bool,
+ * Atom and Table *, the result may also be void.
+ */
+namespace binding {
+
+template <typename T>
+struct NativeType;
+
+template <>
+struct NativeType <int> {
+	static constexpr ValueType type = ValueType::Integer;
+	static bool accepts(ValueType vt) { return vt == ValueType::Integer; }
+	static int unbox(const RValue &rv) { return rv.value<int>(); }
+};
+
+template <>
+struct NativeType <double> {
+	static constexpr ValueType type = ValueType::Real;
+	static bool accepts(ValueType vt) { return vt == ValueType::Real || vt == ValueType::Integer; }
+	static double unbox(const RValue &rv) { return rv.valueType() == ValueType::Integer ? rv.value<int>() : rv.value<double>(); }
+};
+
+template <>
+struct NativeType <bool> {
+	static constexpr ValueType type = ValueType::Boolean;
+	static bool accepts(ValueType vt) { return vt == ValueType::Boolean; }
+	static bool unbox(const RValue &rv) { return rv.value<bool>(); }
+};
+
+template <>
+struct NativeType <Atom> {
+	static constexpr ValueType type = ValueType::String;
+	static bool accepts(ValueType vt) { return vt == ValueType::String; }
+	static Atom unbox(const RValue &rv) { return rv.value<Atom>(); }
+};
+
+template <>
+struct NativeType <Table *> {
+	static constexpr ValueType type = ValueType::Table;
+	static bool accepts(ValueType vt) { return vt == ValueType::Table; }
+	static Table * unbox(const RValue &rv) { return rv.value<Table *>(); }
+};
+
+// Results only
+template <>
+struct NativeType <void> {
+	static constexpr ValueType type = ValueType::Nil;
+};
+
+template <typename T>
+void checkArgument(const RValue &rv, size_t index)
+{
+	if (!NativeType<T>::accepts(rv.valueType())) {
+		std::cerr << "Bad argument #" << index + 1 << ": " << prettyPrint(NativeType<T>::type)
+			<< " expected, got " << prettyPrint(rv.valueType()) << '\n';
+		abort();
+	}
+}
+
+template <typename Fn, Fn F>
+struct Glue;
+
+template <typename R, typename... Args, R (*F)(Args...)>
+struct Glue <R (*)(Args...), F> {
+	static_assert(sizeof...(Args) <= Builtin::MaxArity, "Too many parameters for a builtin");
+
+	static void call(RValue *result, const RValue * const *args, size_t)
+	{
+		invoke(result, args, std::index_sequence_for<Args...>{});
+	}
+
+	template <size_t... I>
+	static void invoke(RValue *result, const RValue * const *args, std::index_sequence <I...>)
+	{
+		(checkArgument<Args>(*args[I], I), ...);
+
+		if constexpr(std::is_void<R>::value) {
+			F(NativeType<Args>::unbox(*args[I])...);
+			result->setNil();
+		} else {
+			result->setValue(F(NativeType<Args>::unbox(*args[I])...));
+		}
+	}
+
+	static constexpr int Arity = sizeof...(Args);
+
+	static inline const Signature signature = {
+		NativeType<R>::type,
+		{NativeType<Args>::type...},
+		reinterpret_cast<void (*)()>(F),
+	};
+};
+
+} //namespace binding
+
+template <auto F>
+Builtin bind(const char *name)
+{
+	typedef binding::Glue <decltype(F), F> Glue;
+	return Builtin{name, Glue::Arity, &Glue::call, &Glue::signature};
+}
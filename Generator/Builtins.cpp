@@ -1,64 +1,91 @@
+#include <cmath>
 #include <iostream>
+#include <limits>
 
+#include "Generator/Binding.hpp"
 #include "Generator/Builtins.hpp"
+#include "Generator/Output.hpp"
 #include "Util/PrettyPrint.hpp"
 
-inline const __arg_vec * args_cast(void *p)
+void __ping(RValue *result, const RValue * const *args, size_t)
 {
-	return reinterpret_cast<const __arg_vec *>(p);
+	Output::stdOut().write(std::string_view{"pong\n"});
+	result->setValue(args[0]->value());
 }
 
-inline RValue * result_cast(void *p)
+void print(RValue *result, const RValue * const *args, size_t argCnt)
 {
-	return reinterpret_cast<RValue *>(p);
-}
-
-void __ping(void *__args, void *__result)
-{
-	auto args = args_cast(__args);
-	auto result = result_cast(__result);
-	std::cout << "pong\n";
-	if (args->empty())
-		result->setNil();
-	else
-		result->setValue((*args)[0]->value());
-}
-
-void print(void *__args, void *__result)
-{
-	auto args = args_cast(__args);
-	auto result = result_cast(__result);
-
-	auto doPrint = [](const RValue *val) {
+	Output &out = Output::stdOut();
+	auto doPrint = [&out](const RValue *val) {
 		switch (val->valueType()) {
 			case ValueType::Integer:
-				std::cout << val->value<int>();
+				out.write(val->value<int>());
 				break;
 			case ValueType::Real:
-				std::cout << val->value<double>();
+				out.write(val->value<double>());
 				break;
 			case ValueType::Boolean:
-				std::cout << std::boolalpha << val->value<bool>();
+				out.write(val->value<bool>());
 				break;
 			case ValueType::String:
-				std::cout << val->value<std::string>();
+				out.write(std::string_view{val->value<Atom>().str()});
 				break;
 			default:
-				std::cout << '<' << prettyPrint(val->valueType()) << '>';
-				if (val->valueType() == ValueType::Table)
-					std::cout << " addr = " << val->value<std::shared_ptr <Table> >();
+				out.write('<');
+				out.write(std::string_view{prettyPrint(val->valueType())});
+				out.write('>');
+				if (val->valueType() == ValueType::Table) {
+					out.write(std::string_view{" addr = "});
+					out.write(static_cast<const void *>(val->value<Table *>()));
+				}
 				break;
 		}
 	};
 
-	if (!args->empty())
-		doPrint((*args)[0]);
+	if (argCnt != 0)
+		doPrint(args[0]);
 
-	for (size_t i = 1; i != args->size(); ++i) {
-		std::cout << ", ";
-		doPrint((*args)[i]);
+	for (size_t i = 1; i != argCnt; ++i) {
+		out.write(std::string_view{", "});
+		doPrint(args[i]);
 	}
-	std::cout << '\n';
+	out.write('\n');
 
 	result->setNil();
 }
+
+namespace {
+
+double squareRoot(double x)
+{
+	return std::sqrt(x);
+}
+
+// Integers are 32 bit, whatever has no integer floor is an error rather than undefined behaviour
+int floorToInt(double x)
+{
+	double result = std::floor(x);
+	if (!(result >= std::numeric_limits<int>::min() && result <= std::numeric_limits<int>::max())) {
+		std::cerr << "floor(" << x << ") does not fit an integer\n";
+		abort();
+	}
+	return static_cast<int>(result);
+}
+
+} //namespace
+
+const std::vector <Builtin> & builtins()
+{
+#define export(funcName, arity) \
+	Builtin{#funcName, arity, &funcName}
+
+	static const std::vector <Builtin> Builtins = {
+		export(__ping, 1),
+		export(print, Builtin::Variadic),
+		bind<squareRoot>("sqrt"),
+		bind<floorToInt>("floor"),
+	};
+#undef export
+
+	return Builtins;
+}
@@ -1,10 +1,42 @@
 #pragma once
 
+#include <array>
 #include <vector>
 
+#include "Generator/Value.hpp"
+
 class RValue;
+struct Signature;
+
+/*
+ * Native function callable from Lua. Arguments arrive as a contiguous span
+ * of RValue pointers, the callers keep it on the stack. A function of fixed
+ * arity always gets exactly that many: missing arguments are Nil, extra ones
+ * are dropped, so it can index args without checking argCnt.
+ */
+struct Builtin {
+	static constexpr int Variadic = -1;
+	static constexpr int MaxArity = 4;
+
+	const char *name;
+	int arity;
+	fn_ptr function;
+	// Only set for builtins bound through Binding.hpp
+	const Signature *signature = nullptr;
+};
+
+/*
+ * Types of a typed binding, native is the bound C++ function itself. The
+ * generator calls it directly when the argument types are known.
+ */
+struct Signature {
+	ValueType result;
+	std::array <ValueType, Builtin::MaxArity> params;
+	void (*native)();
+};
 
-typedef std::vector <RValue *> __arg_vec;
+// Builtin functions, in the order of their slots in the builtin scope
+const std::vector <Builtin> & builtins();
 
-void __ping(void *, void *);
-void print(void *, void *);
+void __ping(RValue *result, const RValue * const *args, size_t argCnt);
+void print(RValue *result, const RValue * const *args, size_t argCnt);
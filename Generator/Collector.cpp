@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "Generator/Collector.hpp"
+#include "Generator/Table.hpp"
+
+namespace {
+
+// Old generation size that triggers the first major collection
+constexpr size_t MinMajorThreshold = 4096;
+// The clock is only read every so many tables during a major step
+constexpr size_t DeadlineCheckInterval = 32;
+
+size_t envSize(const char *name, size_t fallback)
+{
+	const char *value = getenv(name);
+	return value && *value ? strtoull(value, nullptr, 10) : fallback;
+}
+
+void printStatsAtExit()
+{
+	Collector::instance().printStats(std::cerr);
+}
+
+} //namespace
+
+Collector & Collector::instance()
+{
+	// Never destroyed, the statistics are printed by an atexit handler
+	static Collector *collector = new Collector;
+	return *collector;
+}
+
+Collector::Collector()
+{
+	m_nurserySize = std::max<size_t>(envSize("THEJITTER_GC_NURSERY", m_nurserySize), 1);
+	m_pauseBudget = std::chrono::microseconds{envSize("THEJITTER_GC_PAUSE_US", 1000)};
+
+	m_recordStats = getenv("THEJITTER_GC_STATS") != nullptr;
+	if (m_recordStats)
+		atexit(printStatsAtExit);
+}
+
+void Collector::track(Table *table)
+{
+	// Scanning it later sees whatever is stored into it meanwhile
+	if (m_phase == Phase::Marking) {
+		table->m_marked = true;
+		m_grey.push_back(table);
+	}
+	m_nursery.push_back(table);
+}
+
+void Collector::pin(Table *table)
+{
+	table->m_old = true;
+	table->m_barrier = true;
+	m_pinned.push_back(table);
+}
+
+void Collector::releasePinned()
+{
+	for (Table *table : m_pinned) {
+		// Marking treated them as roots, sweeping expects them marked: both keep them for this cycle
+		if (m_phase == Phase::Marking)
+			shade(Value{table});
+		else if (m_phase == Phase::Sweeping)
+			table->m_marked = true;
+		m_old.push_back(table);
+	}
+	m_pinned.clear();
+}
+
+void Collector::barrier(Table *table)
+{
+	table->m_barrier = false;
+	// Already scanned by the major mark, scan it again
+	if (m_phase == Phase::Marking && table->m_marked)
+		m_grey.push_back(table);
+	if (table->m_old && !table->m_remembered) {
+		table->m_remembered = true;
+		m_remembered.push_back(table);
+	}
+}
+
+void Collector::safepoint(const RootScanner &scanRoots)
+{
+	Clock::time_point start = Clock::now();
+
+	switch (m_phase) {
+		case Phase::Idle:
+			if (m_nursery.size() < m_nurserySize)
+				return;
+			minor(scanRoots);
+			if (m_old.size() >= std::max(MinMajorThreshold, 2 * m_liveAfterMajor))
+				startMajor(scanRoots);
+			break;
+		case Phase::Marking:
+			if (markStep(start + m_pauseBudget))
+				finishMark(scanRoots);
+			break;
+		case Phase::Sweeping:
+			sweepStep(start + m_pauseBudget);
+			break;
+	}
+
+	if (m_recordStats)
+		recordPause(start);
+}
+
+/*
+ * Only nursery tables are marked, old tables are not traced except for the
+ * remembered ones: any other path from an old table into the nursery would
+ * have gone through a barrier.
+ */
+void Collector::minor(const RootScanner &scanRoots)
+{
+	std::vector <Table *> grey;
+	Marker mark = [&grey](const Value &v) {
+		if (v.type() != ValueType::Table)
+			return;
+		Table *table = v.get<Table *>();
+		if (!table->m_old && !table->m_marked) {
+			table->m_marked = true;
+			grey.push_back(table);
+		}
+	};
+	auto scan = [&mark](const Table *table) {
+		table->forEach([&mark](const Value &key, const Value &value) {
+			mark(key);
+			mark(value);
+		});
+	};
+
+	scanRoots(mark);
+	for (Table *table : m_remembered) {
+		scan(table);
+		table->m_remembered = false;
+		table->m_barrier = true;
+	}
+	m_remembered.clear();
+
+	while (!grey.empty()) {
+		Table *table = grey.back();
+		grey.pop_back();
+		scan(table);
+	}
+
+	for (Table *table : m_nursery) {
+		if (table->m_marked) {
+			table->m_marked = false;
+			table->m_old = true;
+			table->m_barrier = true;
+			m_old.push_back(table);
+		} else {
+			delete table;
+			++m_stats.freed;
+		}
+	}
+	m_nursery.clear();
+	++m_stats.minorCollections;
+}
+
+void Collector::startMajor(const RootScanner &scanRoots)
+{
+	m_phase = Phase::Marking;
+	Atom::startMark();
+	scanRoots([this](const Value &v) { shade(v); });
+	for (Table *table : m_pinned)
+		shade(Value{table});
+}
+
+void Collector::shade(const Value &v)
+{
+	// Strings hold no references, marking them is all there is to do
+	if (v.type() == ValueType::String)
+		v.get<Atom>().mark();
+	if (v.type() != ValueType::Table)
+		return;
+	Table *table = v.get<Table *>();
+	if (!table->m_marked) {
+		table->m_marked = true;
+		m_grey.push_back(table);
+	}
+}
+
+bool Collector::markStep(Clock::time_point deadline)
+{
+	for (size_t n = 1; !m_grey.empty(); ++n) {
+		Table *table = m_grey.back();
+		m_grey.pop_back();
+		table->forEach([this](const Value &key, const Value &value) {
+			shade(key);
+			shade(value);
+		});
+		// Stores into it have to be seen from now on
+		table->m_barrier = true;
+
+		if (n % DeadlineCheckInterval == 0 && Clock::now() >= deadline)
+			return false;
+	}
+
+	return true;
+}
+
+// Variables are written without barriers, so the roots are scanned once more before the mark is final
+void Collector::finishMark(const RootScanner &scanRoots)
+{
+	scanRoots([this](const Value &v) { shade(v); });
+	markStep(Clock::time_point::max());
+
+	// Strings are leaves, everything reachable is marked by now
+	m_stats.freedStrings += Atom::sweep();
+
+	// The nursery only grew while marking, it is swept right away
+	size_t live = 0;
+	for (Table *table : m_nursery) {
+		if (table->m_marked) {
+			table->m_marked = false;
+			table->m_barrier = false;
+			m_nursery[live++] = table;
+		} else {
+			delete table;
+			++m_stats.freed;
+		}
+	}
+	m_nursery.resize(live);
+
+	for (Table *table : m_pinned) {
+		table->m_marked = false;
+		table->m_barrier = !table->m_remembered;
+	}
+
+	m_remembered.erase(std::remove_if(m_remembered.begin(), m_remembered.end(),
+		[](const Table *table) { return !table->m_marked; }), m_remembered.end());
+	for (Table *table : m_remembered)
+		table->m_barrier = false;
+
+	m_phase = Phase::Sweeping;
+	m_sweepIndex = 0;
+	m_sweepLive = 0;
+}
+
+bool Collector::sweepStep(Clock::time_point deadline)
+{
+	while (m_sweepIndex != m_old.size()) {
+		Table *table = m_old[m_sweepIndex++];
+		if (table->m_marked) {
+			table->m_marked = false;
+			table->m_barrier = !table->m_remembered;
+			m_old[m_sweepLive++] = table;
+		} else {
+			delete table;
+			++m_stats.freed;
+		}
+
+		if (m_sweepIndex % DeadlineCheckInterval == 0 && Clock::now() >= deadline)
+			return false;
+	}
+
+	m_old.resize(m_sweepLive);
+	m_liveAfterMajor = m_sweepLive;
+	m_phase = Phase::Idle;
+	++m_stats.majorCollections;
+	return true;
+}
+
+void Collector::recordPause(Clock::time_point start)
+{
+	double pause = std::chrono::duration<double, std::micro>{Clock::now() - start}.count();
+	++m_stats.pauses;
+	m_stats.pauseTotal += pause;
+	m_stats.pauseMax = std::max(m_stats.pauseMax, pause);
+
+	size_t bucket = static_cast<size_t>(std::ceil(Stats::PauseBucketsPerOctave * std::log2(pause + 1)));
+	++m_stats.pauseHistogram[std::min(bucket, m_stats.pauseHistogram.size() - 1)];
+}
+
+void Collector::printStats(std::ostream &os) const
+{
+	// Upper bound of the bucket holding the pause of rank p, the max is exact
+	auto percentile = [this](double p) {
+		if (m_stats.pauses == 0)
+			return 0.0;
+		size_t rank = static_cast<size_t>(p * (m_stats.pauses - 1));
+		size_t seen = 0;
+		for (size_t i = 0; i != m_stats.pauseHistogram.size(); ++i) {
+			seen += m_stats.pauseHistogram[i];
+			if (seen > rank)
+				return std::min(std::exp2(static_cast<double>(i) / Stats::PauseBucketsPerOctave) - 1, m_stats.pauseMax);
+		}
+		return m_stats.pauseMax;
+	};
+
+	os << "gc: " << m_stats.minorCollections << " minor, " << m_stats.majorCollections << " major collections, "
+		<< m_stats.freed << " tables, " << m_stats.freedStrings << " strings freed\n"
+		<< "gc: " << m_stats.pauses << " pauses, total " << m_stats.pauseTotal << "us, p50 " << percentile(0.5)
+		<< "us, p99 " << percentile(0.99) << "us, max " << m_stats.pauseMax << "us\n";
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iosfwd>
+#include <vector>
+
+#include "Generator/Value.hpp"
+
+class Table;
+
+/*
+ * Generational, incremental mark and sweep collector for the runtime tables,
+ * and for the strings built at run time (see Atom::runtime()), which only
+ * major collections free.
+ *
+ * New tables start out in the nursery. A minor collection traces only the
+ * nursery, from the roots and the remembered old tables, and promotes what
+ * survives. Old tables are reclaimed by a major collection, which marks and
+ * sweeps in steps of bounded length spread over successive safepoints.
+ *
+ * Writes into a table whose barrier flag is set have to be reported through
+ * barrier() before the next safepoint: old tables that are not remembered
+ * yet, and tables the current major mark already scanned.
+ *
+ * Tuned by THEJITTER_GC_NURSERY (tables allocated between minor collections,
+ * default 1024) and THEJITTER_GC_PAUSE_US (time budget of a major step,
+ * default 1000). Setting THEJITTER_GC_STATS records pause statistics and
+ * prints them at exit.
+ */
+class Collector {
+public:
+	// Called with every value outside the heap that may reference a table
+	typedef std::function <void (const Value &)> Marker;
+	typedef std::function <void (const Marker &)> RootScanner;
+
+	struct Stats {
+		static constexpr size_t PauseBucketsPerOctave = 4;
+
+		size_t minorCollections = 0;
+		size_t majorCollections = 0;
+		size_t freed = 0;
+		size_t freedStrings = 0;
+		// Pauses of minor collections and major steps alike, in microseconds
+		size_t pauses = 0;
+		double pauseTotal = 0;
+		double pauseMax = 0;
+		// Log scale, bucket i counts the pauses up to 2^(i / PauseBucketsPerOctave) - 1, percentiles come from it
+		std::array <size_t, 32 * PauseBucketsPerOctave> pauseHistogram{};
+	};
+
+	static Collector & instance();
+
+	Collector(const Collector &) = delete;
+	Collector & operator = (const Collector &) = delete;
+
+	// Runtime tables, freed once unreachable
+	void track(Table *table);
+	// Tables built while compiling, never freed and always roots of a major collection
+	void pin(Table *table);
+	// Once the code they were built for is gone, pinned tables are collected like any old table
+	void releasePinned();
+
+	void barrier(Table *table);
+
+	// Only called when every live value is visible to scanRoots
+	void safepoint(const RootScanner &scanRoots);
+
+	const Stats & stats() const { return m_stats; }
+	void printStats(std::ostream &os) const;
+
+private:
+	enum class Phase {
+		Idle,
+		Marking,
+		Sweeping,
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	Collector();
+
+	void minor(const RootScanner &scanRoots);
+	void startMajor(const RootScanner &scanRoots);
+	// Both return false when the deadline passed before they were done
+	bool markStep(Clock::time_point deadline);
+	bool sweepStep(Clock::time_point deadline);
+	void finishMark(const RootScanner &scanRoots);
+
+	void shade(const Value &v);
+	void recordPause(Clock::time_point start);
+
+	size_t m_nurserySize = 1024;
+	Clock::duration m_pauseBudget = std::chrono::microseconds{1000};
+
+	std::vector <Table *> m_nursery;
+	std::vector <Table *> m_old;
+	std::vector <Table *> m_pinned;
+	// Old tables written to since the last minor collection
+	std::vector <Table *> m_remembered;
+
+	Phase m_phase = Phase::Idle;
+	// Marked but not yet scanned by the major collection
+	std::vector <Table *> m_grey;
+	size_t m_sweepIndex = 0;
+	size_t m_sweepLive = 0;
+	size_t m_liveAfterMajor = 0;
+
+	bool m_recordStats = false;
+	Stats m_stats;
+};
@@ -0,0 +1,180 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Generator/CompileCache.hpp"
+
+namespace {
+
+constexpr const char *CacheFormat = "theJitter compile cache v1";
+constexpr const char *RValueFileMagic = "TJRV";
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i != size; ++i) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+uint64_t fnv1a(uint64_t hash, std::string_view s)
+{
+	// Hash a terminator too, so adjacent strings can't run into each other
+	hash = fnv1a(hash, s.data(), s.size());
+	return fnv1a(hash, "", 1);
+}
+
+std::string cacheDirectory()
+{
+	if (const char *dir = getenv("THEJITTER_CACHE_DIR"))
+		return dir;
+	if (const char *xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg)
+		return std::string{xdg} + "/theJitter";
+	if (const char *home = getenv("HOME"); home && *home)
+		return std::string{home} + "/.cache/theJitter";
+	return {};
+}
+
+// The handle is returned too when asked for, for callers that may still give up on the entry
+Program::EntryPoint openEntryPoint(const std::string &path, void **handleOut = nullptr)
+{
+	void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (handle == nullptr) {
+		std::cerr << "Compile cache: " << dlerror() << '\n';
+		return nullptr;
+	}
+
+	void *entryPoint = dlsym(handle, "__main");
+	if (entryPoint == nullptr) {
+		std::cerr << "Compile cache: " << dlerror() << '\n';
+		dlclose(handle);
+		return nullptr;
+	}
+
+	if (handleOut)
+		*handleOut = handle;
+	return reinterpret_cast<Program::EntryPoint>(entryPoint);
+}
+
+} //namespace
+
+CompileCache::CompileCache(std::string_view source, const std::string &options)
+	: m_dir{cacheDirectory()}
+{
+	if (m_dir.empty())
+		return;
+
+	std::error_code ec;
+	std::filesystem::create_directories(m_dir, ec);
+	if (ec) {
+		std::cerr << "Compile cache disabled, unable to create " << m_dir << ": " << ec.message() << '\n';
+		m_dir.clear();
+		return;
+	}
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	hash = fnv1a(hash, CacheFormat);
+	hash = fnv1a(hash, options);
+	hash = fnv1a(hash, source);
+
+	// Cached code imports the runtime from this executable, a rebuild invalidates it
+	struct stat exe;
+	if (stat("/proc/self/exe", &exe) == 0) {
+		hash = fnv1a(hash, &exe.st_size, sizeof(exe.st_size));
+		hash = fnv1a(hash, &exe.st_mtime, sizeof(exe.st_mtime));
+	}
+
+	char key[17];
+	snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+	m_key = key;
+}
+
+std::string CompileCache::path(const char *suffix) const
+{
+	return m_dir + '/' + m_key + suffix;
+}
+
+Program::EntryPoint CompileCache::load(Program &program) const
+{
+	if (!enabled() || access(path(".so").c_str(), R_OK) != 0)
+		return nullptr;
+
+	std::ifstream rvalues{path(".rvalues"), std::ios::binary};
+	char magic[4];
+	if (!rvalues.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != RValueFileMagic)
+		return nullptr;
+
+	void *handle;
+	Program::EntryPoint entryPoint = openEntryPoint(path(".so"), &handle);
+	if (entryPoint == nullptr)
+		return nullptr;
+	if (!program.loadRValues(rvalues)) {
+		dlclose(handle);
+		return nullptr;
+	}
+
+	return entryPoint;
+}
+
+std::string CompileCache::snapshot(const Program &program)
+{
+	std::ostringstream os;
+	os.write(RValueFileMagic, 4);
+	if (!program.saveRValues(os))
+		return {};
+	return os.str();
+}
+
+Program::EntryPoint CompileCache::store(const Program &program, const std::string &rvalues) const
+{
+	if (!enabled() || rvalues.empty())
+		return nullptr;
+
+	// Write under temporary names and rename, concurrent runs never see partial entries
+	std::string tmpSuffix = ".tmp" + std::to_string(getpid());
+	std::string soPath = path(".so");
+	std::string rvaluesPath = path(".rvalues");
+
+	if (!program.compileToFile(soPath + tmpSuffix))
+		return nullptr;
+
+	{
+		std::ofstream os{rvaluesPath + tmpSuffix, std::ios::binary};
+		if (!os.write(rvalues.data(), rvalues.size())) {
+			std::remove((soPath + tmpSuffix).c_str());
+			std::remove((rvaluesPath + tmpSuffix).c_str());
+			return nullptr;
+		}
+	}
+
+	// The RValue table goes first, the shared object marks the entry as complete
+	if (std::rename((rvaluesPath + tmpSuffix).c_str(), rvaluesPath.c_str()) != 0
+		|| std::rename((soPath + tmpSuffix).c_str(), soPath.c_str()) != 0) {
+		std::cerr << "Compile cache: unable to store " << soPath << '\n';
+		return nullptr;
+	}
+
+	return openEntryPoint(soPath);
+}
+
+unsigned CompileCache::countRun() const
+{
+	if (!enabled())
+		return 1;
+
+	// Best effort, concurrent runs may lose an increment
+	unsigned runs = 0;
+	std::ifstream{path(".runs")} >> runs;
+	++runs;
+	std::ofstream{path(".runs")} << runs << '\n';
+	return runs;
+}
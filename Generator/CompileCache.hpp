@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "Generator/Program.hpp"
+
+/*
+ * Persistent cache of compiled chunks. Entries are keyed by a hash of the
+ * source text, the compiler options and the running executable, and hold
+ * the shared object built by libgccjit plus the RValue table it indexes.
+ *
+ * The cache lives in $THEJITTER_CACHE_DIR, $XDG_CACHE_HOME/theJitter or
+ * ~/.cache/theJitter; setting THEJITTER_CACHE_DIR to an empty string
+ * disables it.
+ */
+class CompileCache {
+public:
+	CompileCache(std::string_view source, const std::string &options);
+
+	bool enabled() const { return !m_dir.empty(); }
+
+	Program::EntryPoint load(Program &program) const;
+
+	// The RValue table has to be serialized before the chunk first runs and
+	// changes it, hence the explicit snapshot
+	static std::string snapshot(const Program &program);
+	Program::EntryPoint store(const Program &program, const std::string &rvalues) const;
+
+	// Counts runs of the chunk across processes, returns the count including
+	// this one; always 1 when the cache is disabled
+	unsigned countRun() const;
+
+private:
+	std::string path(const char *suffix) const;
+
+	std::string m_dir;
+	std::string m_key;
+};
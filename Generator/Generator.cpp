@@ -1,38 +1,86 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <optional>
 #include <type_traits>
 #include <variant>
 
 #include "Generator/AST.hpp"
+#include "Generator/Builtins.hpp"
 #include "Generator/Generator.hpp"
 #include "Generator/Program.hpp"
 #include "Generator/Runtime.hpp"
 #include "Generator/RValue.hpp"
-#include "Util/Casts.hpp"
+#include "Generator/Table.hpp"
+#include "Generator/TypeSet.hpp"
+#include "Util/Fold.hpp"
 #include "Util/PrettyPrint.hpp"
 
 namespace Lua {
 
 namespace {
 
-void runcall(Program &program, gcc_jit_function *func, gcc_jit_block *block, int call, void *arg)
+gcc_jit_rvalue * jitValue(Program &program, gcc_jit_rvalue *v)
 {
-	std::cout << "Generating runcall " << call << " with arg addr = " << arg << '\n';
-	auto ctx = program.context();
-	gcc_jit_rvalue *call_params[2] = {
-		gcc_jit_context_new_rvalue_from_int(ctx, program.type(ValueType::Integer), call),
-		gcc_jit_context_new_rvalue_from_ptr(ctx, program.type(ValueType::Unknown), arg),
-	};
-	gcc_jit_rvalue *jitCall = gcc_jit_context_new_call_through_ptr(ctx, nullptr, program.runtimeCallPtr(), 2, call_params);
-	gcc_jit_block_add_eval(block, nullptr, jitCall);
+	return v;
+}
+
+gcc_jit_rvalue * jitValue(Program &program, const RValue *rv)
+{
+	return program.rvalueRef(rv);
+}
+
+gcc_jit_rvalue * jitValue(Program &program, int v)
+{
+	return gcc_jit_context_new_rvalue_from_int(program.context(), program.type(ValueType::Integer), v);
+}
+
+gcc_jit_rvalue * jitValue(Program &program, size_t v)
+{
+	return gcc_jit_context_new_rvalue_from_long(program.context(), program.sizeType(), v);
+}
+
+template <typename... Args>
+void rtcall(Program &program, gcc_jit_block *block, Program::RuntimeFunction fn, Args... args)
+{
+	std::array <gcc_jit_rvalue *, sizeof...(Args)> params = {jitValue(program, args)...};
+	gcc_jit_rvalue *call = gcc_jit_context_new_call(program.context(), nullptr, program.runtimeFunction(fn), params.size(), params.data());
+	gcc_jit_block_add_eval(block, nullptr, call);
 }
 
-#define RUNCALL(call, arg) \
-	runcall(program, func, block, (call), (arg))
+#define RTCALL(fn, ...) \
+	rtcall(program, block, Program::RuntimeFunction::fn, ##__VA_ARGS__)
+
+// Stores RValue pointers into a stack allocated array and returns its address
+gcc_jit_rvalue * generatePointerArray(Program &program, gcc_jit_function *func, gcc_jit_block *block, const std::vector <RValue *> &values)
+{
+	auto ctx = program.context();
+	if (values.empty())
+		return gcc_jit_context_null(ctx, gcc_jit_type_get_pointer(program.type(ValueType::Unknown)));
+
+	gcc_jit_lvalue *array = gcc_jit_function_new_local(func, nullptr, program.pointerArrayType(values.size()), "ptrArray");
+	for (size_t i = 0; i != values.size(); ++i) {
+		gcc_jit_lvalue *elem = gcc_jit_context_new_array_access(ctx, nullptr, gcc_jit_lvalue_as_rvalue(array), jitValue(program, static_cast<int>(i)));
+		gcc_jit_block_add_assignment(block, nullptr, elem, jitValue(program, values[i]));
+	}
+
+	gcc_jit_lvalue *first = gcc_jit_context_new_array_access(ctx, nullptr, gcc_jit_lvalue_as_rvalue(array), jitValue(program, 0));
+	return gcc_jit_lvalue_get_address(first, nullptr);
+}
 
 template <Node::Type type>
-RValue * generate(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src);
+RValue * generate(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src);
+
+RValue * dispatch(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src);
+
+RValue * generateLValue(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const LValue *lval, bool assign);
+
+void generateCachedGet(Program &program, gcc_jit_function *func, gcc_jit_block *&block, RValue *result, const RValue *table, const RValue *key, bool assign);
 
-RValue * dispatch(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src);
+RValue * copyValue(Program &program, gcc_jit_block *block, const RValue *rvalue);
+
+bool generateNativeCall(Program &program, gcc_jit_function *func, gcc_jit_block *&block, RValue *result,
+	const FunctionCall *f, const RValue *fn, const std::vector <RValue *> &args);
 
 void checkType(const RValue *rvalue, const Node *n)
 {
@@ -43,13 +91,13 @@ void checkType(const RValue *rvalue, const Node *n)
 	}
 }
 
-std::vector <RValue *> generateExprList(Program &program, gcc_jit_function *func, gcc_jit_block *block, const ExprList *exprList)
+std::vector <RValue *> generateExprList(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const ExprList *exprList)
 {
 	std::vector <RValue *> exprResults(exprList->exprs().size());
 	size_t i = 0;
 
 	for (const auto &expr : exprList->exprs()) {
-		exprResults[i] = dispatch(program, func, block, expr.get());
+		exprResults[i] = dispatch(program, func, block, expr);
 		if (exprResults[i] == nullptr)
 			exprResults[i] = program.allocRValue(RValue::Nil());
 		++i;
@@ -58,7 +106,7 @@ std::vector <RValue *> generateExprList(Program &program, gcc_jit_function *func
 }
 
 template <>
-RValue * generate<Node::Type::FunctionCall>(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+RValue * generate<Node::Type::FunctionCall>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	const FunctionCall *f = static_cast<const FunctionCall *>(src);
 	RValue *funcResolved = dispatch(program, func, block, f->functionExpr());
@@ -71,32 +119,33 @@ RValue * generate<Node::Type::FunctionCall>(Program &program, gcc_jit_function *
 	const ExprList *args = f->args();
 	std::vector <RValue *> exprResults = generateExprList(program, func, block, args);
 
-	RValue *result = program.allocRValue();
+	RValue *result = program.allocTemporary();
+	if (!generateNativeCall(program, func, block, result, f, funcResolved, exprResults))
+		RTCALL(FunctionCall, result, funcResolved, exprResults.size(), generatePointerArray(program, func, block, exprResults));
 
-	RUNCALL(RUNCALL_PUSH, result);
-	for (auto i = exprResults.crbegin(); i != exprResults.crend(); ++i)
-		RUNCALL(RUNCALL_PUSH, *i);
-	RUNCALL(RUNCALL_PUSH, toVoidPtr(args->exprs().size()));
-	RUNCALL(RUNCALL_PUSH, funcResolved);
-	RUNCALL(RUNCALL_FUNCTION_CALL, nullptr);
+	program.releaseTemporary(funcResolved);
+	for (const RValue *arg : exprResults)
+		program.releaseTemporary(arg);
 
 	return result;
 }
 
 template <>
-RValue * generate<Node::Type::TableCtor>(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+RValue * generate<Node::Type::TableCtor>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	const TableCtor *tv = static_cast<const TableCtor *>(src);
 
-	RValue *result = program.allocRValue();
-	RUNCALL(RUNCALL_PUSH, result);
+	RValue *result = program.allocTemporary();
 
+	// Keyed fields go first, so positional entries take precedence on conflicting keys
 	const auto &fields = tv->fields();
+	std::vector <RValue *> positional;
+	std::vector <RValue *> keyed;
 	int fieldCounter = 0;
 	for (const auto &field : fields) {
 		if (field->fieldType() == Field::Type::NoIndex) {
-			RUNCALL(RUNCALL_PUSH, dispatch(program, func, block, field->valueExpr()));
-			RUNCALL(RUNCALL_PUSH, program.allocRValue(RValue{++fieldCounter}));
+			positional.push_back(program.allocRValue(RValue{++fieldCounter}));
+			positional.push_back(dispatch(program, func, block, field->valueExpr()));
 		}
 	}
 
@@ -113,33 +162,54 @@ RValue * generate<Node::Type::TableCtor>(Program &program, gcc_jit_function *fun
 				default:
 					break;
 			}
-			RUNCALL(RUNCALL_PUSH, dispatch(program, func, block, field->valueExpr()));
-			RUNCALL(RUNCALL_PUSH, index);
+			keyed.push_back(index);
+			keyed.push_back(dispatch(program, func, block, field->valueExpr()));
 		}
 	}
 
-	RUNCALL(RUNCALL_PUSH, toVoidPtr(fields.size()));
-	RUNCALL(RUNCALL_TABLE_CTOR, nullptr);
+	keyed.insert(keyed.end(), positional.begin(), positional.end());
+	gcc_jit_rvalue *fieldArray = generatePointerArray(program, func, block, keyed);
+
+	// With constant keys the layout is prebuilt here and the runtime only copies it and fills in values
+	bool constantKeys = !fields.empty();
+	for (size_t i = 0; i < keyed.size(); i += 2)
+		constantKeys = constantKeys && keyed[i]->type() == RValue::Type::Immediate && !keyed[i]->isNil();
+
+	if (constantKeys) {
+		Table *shape = Table::createPinned(positional.size() / 2, (keyed.size() - positional.size()) / 2);
+		for (size_t i = 0; i < keyed.size(); i += 2)
+			shape->getOrInsert(*keyed[i]);
+		RTCALL(TableClone, result, program.allocRValue(RValue{shape}), fields.size(), fieldArray);
+	} else {
+		RTCALL(TableCtor, result, positional.size() / 2, fields.size(), fieldArray);
+	}
+
+	for (const RValue *field : keyed)
+		program.releaseTemporary(field);
 
 	return result;
 }
 
 template <>
-RValue * generate<Node::Type::Chunk>(Program &program, gcc_jit_function *func, gcc_jit_block *, const Node *src)
+RValue * generate<Node::Type::Chunk>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	const Chunk *c = static_cast<const Chunk *>(src);
-	gcc_jit_block *block = gcc_jit_function_new_block(func, nullptr);
-	RUNCALL(RUNCALL_SCOPE_PUSH, nullptr);
-
-	for (const auto &n : c->children())
-		dispatch(program, func, block, n.get());
+	if (program.batch() == 0)
+		RTCALL(ScopePush, program.resolver().slotCount(c));
+	else
+		RTCALL(ScopeGrow, program.resolver().slotCount(c));
+
+	// Nothing outlives a statement, whatever it left behind is free for the next one
+	for (const auto &n : c->children()) {
+		program.releaseTemporary(dispatch(program, func, block, n));
+		RTCALL(GcSafepoint);
+	}
 
-	gcc_jit_block_end_with_void_return(block, nullptr);
 	return nullptr;
 }
 
 template <>
-RValue * generate<Node::Type::Value>(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+RValue * generate<Node::Type::Value>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	const Value *v = static_cast<const Value *>(src);
 
@@ -154,6 +224,13 @@ RValue * generate<Node::Type::Value>(Program &program, gcc_jit_function *func, g
 			return program.allocRValue(RValue{static_cast<const RealValue *>(v)->value()});
 		case ValueType::String:
 			return program.allocRValue(RValue{static_cast<const StringValue *>(v)->value()});
+		case ValueType::Table: {
+			// Folded constructor, the script gets a copy of the prebuilt table
+			RValue *result = program.allocTemporary();
+			RTCALL(TableClone, result, program.allocRValue(RValue{static_cast<const TableValue *>(v)->value()}),
+				size_t{0}, generatePointerArray(program, func, block, {}));
+			return result;
+		}
 		default:
 			break;
 	}
@@ -163,60 +240,603 @@ RValue * generate<Node::Type::Value>(Program &program, gcc_jit_function *func, g
 	return nullptr;
 }
 
-template <>
-RValue * generate<Node::Type::LValue>(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+/*
+ * Table fields are only added by assignment targets, reads of a missing
+ * key yield a Nil temporary and leave the table as it is.
+ */
+RValue * generateLValue(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const LValue *lval, bool assign)
 {
-	const LValue *lval = static_cast<const LValue *>(src);
-	RValue *result = program.allocRValue();
-	RUNCALL(RUNCALL_PUSH, result);
+	RValue *result = program.allocTemporary();
 
 	switch (lval->lvalueType()) {
 		case LValue::Type::Bracket:
 		case LValue::Type::Dot: {
+			RValue *key;
+			if (lval->lvalueType() == LValue::Type::Dot)
+				key = program.allocRValue(lval->name());
+			else
+				key = dispatch(program, func, block, lval->keyExpr());
+			RValue *table = dispatch(program, func, block, lval->tableExpr());
 			if (lval->lvalueType() == LValue::Type::Dot)
-				RUNCALL(RUNCALL_PUSH, program.allocRValue(lval->name()));
+				generateCachedGet(program, func, block, result, table, key, assign);
+			else if (assign)
+				RTCALL(TableLValue, result, table, key);
 			else
-				RUNCALL(RUNCALL_PUSH, dispatch(program, func, block, lval->keyExpr()));
-			RUNCALL(RUNCALL_PUSH, dispatch(program, func, block, lval->tableExpr()));
-			RUNCALL(RUNCALL_TABLE_ACCESS, nullptr);
+				RTCALL(TableGet, result, table, key);
+			program.releaseTemporary(table);
+			program.releaseTemporary(key);
+			if (assign)
+				result->setType(RValue::Type::LValue);
 			break;
 		}
 
 		case LValue::Type::Name: {
-			RUNCALL(RUNCALL_PUSH, program.duplicateString(lval->name()));
-			RUNCALL(RUNCALL_RESOLVE_NAME, nullptr);
+			Resolver::Slot slot = program.resolver().slot(lval);
+			RTCALL(ResolveSlot, result, slot.depth, slot.index);
+			result->setType(RValue::Type::LValue);
 			break;
 		}
 	}
 
-	result->setType(RValue::Type::LValue);
 	return result;
 }
 
 template <>
-RValue * generate<Node::Type::Assignment>(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+RValue * generate<Node::Type::LValue>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
+{
+	return generateLValue(program, func, block, static_cast<const LValue *>(src), false);
+}
+
+template <>
+RValue * generate<Node::Type::Assignment>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	const Assignment *c = static_cast<const Assignment *>(src);
 	const ExprList *exprList = c->exprList();
 	std::vector <RValue *> exprResults = generateExprList(program, func, block, exprList);
 
-	size_t i = 0;
+	// Variables read on the right still point at their storage, a store to one of them must not show through: a, b = b, a
 	const VarList *varList = c->varList();
+	if (varList->vars().size() > 1) {
+		for (RValue *&expr : exprResults) {
+			if (expr->type() == RValue::Type::LValue) {
+				RValue *copy = copyValue(program, block, expr);
+				program.releaseTemporary(expr);
+				expr = copy;
+			}
+		}
+	}
+
+	size_t i = 0;
 	for (const auto &lval : varList->vars()) {
-		RValue *dst = dispatch(program, func, block, lval.get());
+		RValue *dst = generateLValue(program, func, block, lval, true);
 		if (i < exprResults.size())
-			RUNCALL(RUNCALL_PUSH, exprResults[i]);
+			RTCALL(Assign, dst, exprResults[i]);
 		else
-			RUNCALL(RUNCALL_PUSH, program.allocRValue(RValue::Nil()));
-		RUNCALL(RUNCALL_PUSH, dst);
-		RUNCALL(RUNCALL_ASSIGN, nullptr);
+			RTCALL(Assign, dst, program.allocRValue(RValue::Nil()));
 
+		program.releaseTemporary(dst);
 		++i;
 	}
 
+	for (const RValue *expr : exprResults)
+		program.releaseTemporary(expr);
+
 	return nullptr;
 }
 
+/*
+ * Native arithmetic: operands guarded to be Integer or Real are computed with
+ * plain gcc_jit operations on int/double values read straight from the
+ * NaN-boxed value word of the RValue, anything else falls back to the
+ * rt_unop()/rt_binop() runtime path. Guards for types TypeInference ruled out
+ * or proved are not emitted.
+ */
+struct NativeOperand {
+	TypeSet types;
+	gcc_jit_rvalue *word; // only loaded when more than one type is possible
+	gcc_jit_rvalue *intValue;
+	gcc_jit_rvalue *realValue;
+};
+
+gcc_jit_type * wordType(Program &program)
+{
+	return gcc_jit_context_get_type(program.context(), GCC_JIT_TYPE_UINT64_T);
+}
+
+gcc_jit_rvalue * wordValue(Program &program, uint64_t v)
+{
+	return gcc_jit_context_new_rvalue_from_long(program.context(), wordType(program), static_cast<long>(v));
+}
+
+gcc_jit_type * bytePtrType(Program &program)
+{
+	return gcc_jit_type_get_pointer(gcc_jit_context_get_type(program.context(), GCC_JIT_TYPE_CHAR));
+}
+
+// *(type *) &((char *) base)[offset]
+gcc_jit_lvalue * field(Program &program, gcc_jit_rvalue *base, size_t offset, gcc_jit_type *type)
+{
+	auto ctx = program.context();
+	gcc_jit_rvalue *bytes = gcc_jit_context_new_cast(ctx, nullptr, base, bytePtrType(program));
+	gcc_jit_lvalue *byte = gcc_jit_context_new_array_access(ctx, nullptr, bytes, jitValue(program, offset));
+	gcc_jit_rvalue *ptr = gcc_jit_context_new_cast(ctx, nullptr, gcc_jit_lvalue_get_address(byte, nullptr), gcc_jit_type_get_pointer(type));
+	return gcc_jit_rvalue_dereference(ptr, nullptr);
+}
+
+gcc_jit_lvalue * field(Program &program, const RValue *rvalue, size_t offset, gcc_jit_type *type)
+{
+	return field(program, program.rvalueRef(rvalue), offset, type);
+}
+
+gcc_jit_rvalue * loadField(Program &program, const RValue *rvalue, size_t offset, gcc_jit_type *type)
+{
+	return gcc_jit_lvalue_as_rvalue(field(program, rvalue, offset, type));
+}
+
+// The value word of an operand, lvalues are read through their pointer like RValue::value() does
+gcc_jit_rvalue * loadValue(Program &program, const RValue *rvalue, gcc_jit_type *type)
+{
+	const RValue::Layout &layout = RValue::layout();
+	if (rvalue->type() != RValue::Type::LValue)
+		return loadField(program, rvalue, layout.value, type);
+
+	gcc_jit_rvalue *storage = loadField(program, rvalue, layout.lvalue, program.type(ValueType::Unknown));
+	return gcc_jit_lvalue_as_rvalue(field(program, storage, 0, type));
+}
+
+// A temporary holding the current value of rvalue, RValue::setValue() in generated code
+RValue * copyValue(Program &program, gcc_jit_block *block, const RValue *rvalue)
+{
+	const RValue::Layout &layout = RValue::layout();
+	RValue *result = program.allocTemporary();
+
+	gcc_jit_block_add_assignment(block, nullptr, field(program, result, layout.value, wordType(program)),
+		loadValue(program, rvalue, wordType(program)));
+	gcc_jit_type *typeType = program.type(ValueType::Integer);
+	gcc_jit_block_add_assignment(block, nullptr, field(program, result, layout.type, typeType),
+		gcc_jit_context_new_rvalue_from_int(program.context(), typeType, toUnderlying(RValue::Type::Temporary)));
+	return result;
+}
+
+NativeOperand nativeOperand(Program &program, gcc_jit_function *func, gcc_jit_block *block, const RValue *rvalue, TypeSet types)
+{
+	auto ctx = program.context();
+
+	if (rvalue->type() == RValue::Type::Immediate) {
+		switch (rvalue->valueType()) {
+			case ValueType::Integer:
+				return {ValueType::Integer, nullptr,
+					gcc_jit_context_new_rvalue_from_int(ctx, program.type(ValueType::Integer), rvalue->value<int>()), nullptr};
+			case ValueType::Real:
+				return {ValueType::Real, nullptr, nullptr,
+					gcc_jit_context_new_rvalue_from_double(ctx, program.type(ValueType::Real), rvalue->value<double>())};
+			default:
+				return {rvalue->valueType(), nullptr, nullptr, nullptr};
+		}
+	}
+
+	NativeOperand result{types, nullptr, nullptr, nullptr};
+
+	if (!types.single()) {
+		gcc_jit_lvalue *word = gcc_jit_function_new_local(func, nullptr, wordType(program), "word");
+		gcc_jit_block_add_assignment(block, nullptr, word, loadValue(program, rvalue, wordType(program)));
+		result.word = gcc_jit_lvalue_as_rvalue(word);
+	}
+
+	// Integers are the low 32 bits of the word, the targets libgccjit supports are little endian
+	if (types.contains(ValueType::Integer))
+		result.intValue = loadValue(program, rvalue, program.type(ValueType::Integer));
+	if (types.contains(ValueType::Real))
+		result.realValue = loadValue(program, rvalue, program.type(ValueType::Real));
+
+	return result;
+}
+
+gcc_jit_rvalue * isType(Program &program, const NativeOperand &operand, ValueType vt)
+{
+	auto ctx = program.context();
+	if (operand.word == nullptr || !operand.types.contains(vt))
+		return gcc_jit_context_new_rvalue_from_int(ctx, program.type(ValueType::Boolean), operand.types.contains(vt));
+
+	if (vt == ValueType::Real)
+		return gcc_jit_context_new_comparison(ctx, nullptr, GCC_JIT_COMPARISON_LT, operand.word, wordValue(program, ::Value::FirstBoxed));
+
+	gcc_jit_rvalue *tag = gcc_jit_context_new_binary_op(ctx, nullptr, GCC_JIT_BINARY_OP_RSHIFT, wordType(program),
+		operand.word, wordValue(program, ::Value::TagShift));
+	return gcc_jit_context_new_comparison(ctx, nullptr, GCC_JIT_COMPARISON_EQ, tag, wordValue(program, ::Value::tagWord(vt)));
+}
+
+gcc_jit_rvalue * isNumber(Program &program, const NativeOperand &operand)
+{
+	return gcc_jit_context_new_binary_op(program.context(), nullptr, GCC_JIT_BINARY_OP_LOGICAL_OR, program.type(ValueType::Boolean),
+		isType(program, operand, ValueType::Integer), isType(program, operand, ValueType::Real));
+}
+
+gcc_jit_rvalue * logicalAnd(Program &program, gcc_jit_rvalue *a, gcc_jit_rvalue *b)
+{
+	return gcc_jit_context_new_binary_op(program.context(), nullptr, GCC_JIT_BINARY_OP_LOGICAL_AND, program.type(ValueType::Boolean), a, b);
+}
+
+// Reads an operand known to be numeric as double, converting from int the way matchTypes() does
+gcc_jit_rvalue * loadReal(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const NativeOperand &operand)
+{
+	auto ctx = program.context();
+	gcc_jit_type *realType = program.type(ValueType::Real);
+
+	if (!operand.types.contains(ValueType::Real))
+		return gcc_jit_context_new_cast(ctx, nullptr, operand.intValue, realType);
+	if (!operand.types.contains(ValueType::Integer))
+		return operand.realValue;
+
+	gcc_jit_lvalue *result = gcc_jit_function_new_local(func, nullptr, realType, "real");
+	gcc_jit_block *fromInt = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *fromReal = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *join = gcc_jit_function_new_block(func, nullptr);
+
+	gcc_jit_block_end_with_conditional(block, nullptr, isType(program, operand, ValueType::Integer), fromInt, fromReal);
+	gcc_jit_block_add_assignment(fromInt, nullptr, result, gcc_jit_context_new_cast(ctx, nullptr, operand.intValue, realType));
+	gcc_jit_block_end_with_jump(fromInt, nullptr, join);
+	gcc_jit_block_add_assignment(fromReal, nullptr, result, operand.realValue);
+	gcc_jit_block_end_with_jump(fromReal, nullptr, join);
+
+	block = join;
+	return gcc_jit_lvalue_as_rvalue(result);
+}
+
+/*
+ * Writes the boxed result word and marks dst as a temporary, the same thing
+ * RValue::setValue() does. Reals are stored as they are: operands were
+ * canonicalized when boxed, so native arithmetic cannot produce a NaN that
+ * looks boxed.
+ */
+void storeNative(Program &program, gcc_jit_block *block, RValue *dst, ValueType vt, gcc_jit_rvalue *value)
+{
+	auto ctx = program.context();
+	const RValue::Layout &layout = RValue::layout();
+
+	if (vt == ValueType::Integer) {
+		gcc_jit_rvalue *payload = gcc_jit_context_new_cast(ctx, nullptr,
+			gcc_jit_context_new_cast(ctx, nullptr, value, gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_UINT32_T)), wordType(program));
+		gcc_jit_block_add_assignment(block, nullptr, field(program, dst, layout.value, wordType(program)),
+			gcc_jit_context_new_binary_op(ctx, nullptr, GCC_JIT_BINARY_OP_BITWISE_OR, wordType(program), payload, wordValue(program, ::Value{0}.bits())));
+	} else {
+		gcc_jit_block_add_assignment(block, nullptr, field(program, dst, layout.value, program.type(ValueType::Real)), value);
+	}
+
+	gcc_jit_type *typeType = program.type(ValueType::Integer);
+	gcc_jit_block_add_assignment(block, nullptr, field(program, dst, layout.type, typeType),
+		gcc_jit_context_new_rvalue_from_int(ctx, typeType, toUnderlying(RValue::Type::Temporary)));
+}
+
+/*
+ * Dot access through an inline cache: when the table has the shape this site
+ * saw last, the value is read from the cached hash slot without hashing the
+ * key. Everything else goes through rt_table_get_cached() for reads and
+ * rt_table_lvalue_cached() for assignment targets, both refill the cache.
+ */
+void generateCachedGet(Program &program, gcc_jit_function *func, gcc_jit_block *&block, RValue *result, const RValue *table, const RValue *key, bool assign)
+{
+	static_assert(sizeof(InlineCache) == 3 * sizeof(uint64_t), "InlineCache is addressed as three words");
+
+	auto ctx = program.context();
+	gcc_jit_type *ptrType = program.type(ValueType::Unknown);
+	const RValue::Layout &layout = RValue::layout();
+	const Table::Layout &tableLayout = Table::layout();
+
+	size_t cache = program.allocInlineCache();
+	gcc_jit_rvalue *caches = gcc_jit_context_new_cast(ctx, nullptr, program.inlineCaches(), gcc_jit_type_get_pointer(wordType(program)));
+	auto cacheField = [&](size_t offset) {
+		return gcc_jit_context_new_array_access(ctx, nullptr, caches, jitValue(program, cache * 3 + offset / sizeof(uint64_t)));
+	};
+	gcc_jit_rvalue *cacheRef = gcc_jit_context_new_cast(ctx, nullptr, gcc_jit_lvalue_get_address(cacheField(0), nullptr), ptrType);
+
+	gcc_jit_block *checkShape = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *hit = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *miss = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *join = gcc_jit_function_new_block(func, nullptr);
+
+	gcc_jit_lvalue *word = gcc_jit_function_new_local(func, nullptr, wordType(program), "tableWord");
+	gcc_jit_block_add_assignment(block, nullptr, word, loadValue(program, table, wordType(program)));
+	gcc_jit_rvalue *tag = gcc_jit_context_new_binary_op(ctx, nullptr, GCC_JIT_BINARY_OP_RSHIFT, wordType(program),
+		gcc_jit_lvalue_as_rvalue(word), wordValue(program, ::Value::TagShift));
+	gcc_jit_block_end_with_conditional(block, nullptr,
+		gcc_jit_context_new_comparison(ctx, nullptr, GCC_JIT_COMPARISON_EQ, tag, wordValue(program, ::Value::tagWord(ValueType::Table))),
+		checkShape, miss);
+
+	// libgccjit has no integer to pointer cast, the payload is read back through its address instead
+	gcc_jit_lvalue *payload = gcc_jit_function_new_local(func, nullptr, wordType(program), "tablePayload");
+	gcc_jit_block_add_assignment(checkShape, nullptr, payload, gcc_jit_context_new_binary_op(ctx, nullptr, GCC_JIT_BINARY_OP_BITWISE_AND,
+		wordType(program), gcc_jit_lvalue_as_rvalue(word), wordValue(program, ::Value::PayloadMask)));
+	gcc_jit_rvalue *tablePtr = gcc_jit_lvalue_as_rvalue(gcc_jit_rvalue_dereference(gcc_jit_context_new_cast(ctx, nullptr,
+		gcc_jit_lvalue_get_address(payload, nullptr), gcc_jit_type_get_pointer(ptrType)), nullptr));
+
+	gcc_jit_rvalue *shape = gcc_jit_lvalue_as_rvalue(field(program, tablePtr, tableLayout.shape, wordType(program)));
+	gcc_jit_block_end_with_conditional(checkShape, nullptr,
+		gcc_jit_context_new_comparison(ctx, nullptr, GCC_JIT_COMPARISON_EQ, shape, gcc_jit_lvalue_as_rvalue(cacheField(offsetof(InlineCache, shape)))),
+		hit, miss);
+
+	// segments[cache.segment] + cache.offset
+	gcc_jit_rvalue *segments = gcc_jit_lvalue_as_rvalue(field(program, tablePtr, tableLayout.hashSegments, gcc_jit_type_get_pointer(bytePtrType(program))));
+	gcc_jit_rvalue *segment = gcc_jit_lvalue_as_rvalue(gcc_jit_context_new_array_access(ctx, nullptr, segments,
+		gcc_jit_lvalue_as_rvalue(cacheField(offsetof(InlineCache, segment)))));
+	gcc_jit_rvalue *offset = gcc_jit_context_new_binary_op(ctx, nullptr, GCC_JIT_BINARY_OP_MULT, wordType(program),
+		gcc_jit_lvalue_as_rvalue(cacheField(offsetof(InlineCache, offset))), wordValue(program, sizeof(::Value)));
+	gcc_jit_rvalue *slot = gcc_jit_lvalue_get_address(gcc_jit_context_new_array_access(ctx, nullptr, segment, offset), nullptr);
+
+	// Stores through the lvalue are reported to the collector up front, like rt_table_lvalue() does
+	if (assign) {
+		gcc_jit_block *barrier = gcc_jit_function_new_block(func, nullptr);
+		gcc_jit_block *store = gcc_jit_function_new_block(func, nullptr);
+		gcc_jit_rvalue *needsBarrier = gcc_jit_lvalue_as_rvalue(field(program, tablePtr, tableLayout.barrier, program.type(ValueType::Boolean)));
+		gcc_jit_block_end_with_conditional(hit, nullptr, needsBarrier, barrier, store);
+		rtcall(program, barrier, Program::RuntimeFunction::GcBarrier, tablePtr);
+		gcc_jit_block_end_with_jump(barrier, nullptr, store);
+		hit = store;
+	}
+
+	// The same as RValue::setLValue(), or RValue::setValue() for reads
+	gcc_jit_type *typeType = program.type(ValueType::Integer);
+	if (assign)
+		gcc_jit_block_add_assignment(hit, nullptr, field(program, result, layout.lvalue, ptrType), gcc_jit_context_new_cast(ctx, nullptr, slot, ptrType));
+	else
+		gcc_jit_block_add_assignment(hit, nullptr, field(program, result, layout.value, wordType(program)),
+			gcc_jit_lvalue_as_rvalue(field(program, slot, 0, wordType(program))));
+	gcc_jit_block_add_assignment(hit, nullptr, field(program, result, layout.type, typeType),
+		gcc_jit_context_new_rvalue_from_int(ctx, typeType, toUnderlying(assign ? RValue::Type::LValue : RValue::Type::Temporary)));
+	gcc_jit_block_end_with_jump(hit, nullptr, join);
+
+	rtcall(program, miss, assign ? Program::RuntimeFunction::TableLValueCached : Program::RuntimeFunction::TableGetCached, result, table, key, cacheRef);
+	gcc_jit_block_end_with_jump(miss, nullptr, join);
+
+	block = join;
+}
+
+/*
+ * Direct call of a typed binding: the callee is named like a builtin bound
+ * through Binding.hpp and every argument may have its parameter's type.
+ * The code checks that the callee still is that builtin and that the
+ * arguments have those types, then calls the bound C++ function with unboxed
+ * arguments. Everything else goes through rt_function_call(). Only numeric
+ * signatures are called this way for now.
+ */
+bool generateNativeCall(Program &program, gcc_jit_function *func, gcc_jit_block *&block, RValue *result,
+	const FunctionCall *f, const RValue *fn, const std::vector <RValue *> &args)
+{
+	const Node *callee = f->functionExpr();
+	if (callee->type() != Node::Type::LValue || static_cast<const LValue *>(callee)->lvalueType() != LValue::Type::Name)
+		return false;
+
+	const Atom name = static_cast<const LValue *>(callee)->name();
+	const std::vector <Builtin> &table = builtins();
+	auto builtin = std::find_if(table.begin(), table.end(), [name](const Builtin &b) { return b.signature != nullptr && name == Atom{b.name}; });
+	if (builtin == table.end() || static_cast<size_t>(builtin->arity) != args.size())
+		return false;
+
+	const Signature &signature = *builtin->signature;
+	const TypeSet numbers = TypeSet::numbers();
+	if (!any_of(signature.result, ValueType::Integer, ValueType::Real))
+		return false;
+
+	std::vector <TypeSet> argTypes;
+	for (size_t i = 0; i != args.size(); ++i) {
+		ValueType param = signature.params[i];
+		TypeSet types = program.typeInference().types(f->args()->exprs()[i]);
+		if (param == ValueType::Integer ? !types.contains(ValueType::Integer) : param != ValueType::Real || (types & numbers).empty())
+			return false;
+		argTypes.push_back(types);
+	}
+
+	auto ctx = program.context();
+	gcc_jit_type *ptrType = program.type(ValueType::Unknown);
+
+	// Same as Value::get<const Builtin *>(), compared with the entry of the builtin in the table
+	gcc_jit_lvalue *word = gcc_jit_function_new_local(func, nullptr, wordType(program), "calleeWord");
+	gcc_jit_block_add_assignment(block, nullptr, word, loadValue(program, fn, wordType(program)));
+	gcc_jit_rvalue *tag = gcc_jit_context_new_binary_op(ctx, nullptr, GCC_JIT_BINARY_OP_RSHIFT, wordType(program),
+		gcc_jit_lvalue_as_rvalue(word), wordValue(program, ::Value::TagShift));
+	gcc_jit_lvalue *payload = gcc_jit_function_new_local(func, nullptr, wordType(program), "calleePayload");
+	gcc_jit_block_add_assignment(block, nullptr, payload, gcc_jit_context_new_binary_op(ctx, nullptr, GCC_JIT_BINARY_OP_BITWISE_AND,
+		wordType(program), gcc_jit_lvalue_as_rvalue(word), wordValue(program, ::Value::PayloadMask)));
+	gcc_jit_rvalue *calleePtr = gcc_jit_lvalue_as_rvalue(gcc_jit_rvalue_dereference(gcc_jit_context_new_cast(ctx, nullptr,
+		gcc_jit_lvalue_get_address(payload, nullptr), gcc_jit_type_get_pointer(bytePtrType(program))), nullptr));
+	size_t index = builtin - table.begin();
+	gcc_jit_rvalue *expected = gcc_jit_lvalue_get_address(field(program, program.builtins(), index * sizeof(Builtin),
+		gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR)), nullptr);
+
+	gcc_jit_rvalue *matches = logicalAnd(program,
+		gcc_jit_context_new_comparison(ctx, nullptr, GCC_JIT_COMPARISON_EQ, tag, wordValue(program, ::Value::tagWord(ValueType::Function))),
+		gcc_jit_context_new_comparison(ctx, nullptr, GCC_JIT_COMPARISON_EQ, calleePtr, expected));
+
+	std::vector <NativeOperand> operands;
+	for (size_t i = 0; i != args.size(); ++i) {
+		operands.push_back(nativeOperand(program, func, block, args[i], argTypes[i]));
+		const NativeOperand &o = operands.back();
+		matches = logicalAnd(program, matches,
+			signature.params[i] == ValueType::Integer ? isType(program, o, ValueType::Integer) : isNumber(program, o));
+	}
+
+	gcc_jit_block *call = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *fallback = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *join = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block_end_with_conditional(block, nullptr, matches, call, fallback);
+
+	std::vector <gcc_jit_rvalue *> params;
+	std::vector <gcc_jit_type *> paramTypes;
+	for (size_t i = 0; i != args.size(); ++i) {
+		bool isInt = signature.params[i] == ValueType::Integer;
+		params.push_back(isInt ? operands[i].intValue : loadReal(program, func, call, operands[i]));
+		paramTypes.push_back(program.type(signature.params[i]));
+	}
+
+	// The native pointer is read from the Signature at run time, the code stays valid in the compile cache
+	gcc_jit_type *nativeType = gcc_jit_context_new_function_ptr_type(ctx, nullptr, program.type(signature.result),
+		paramTypes.size(), paramTypes.data(), 0);
+	gcc_jit_rvalue *signaturePtr = gcc_jit_lvalue_as_rvalue(field(program, calleePtr, offsetof(Builtin, signature), ptrType));
+	gcc_jit_rvalue *native = gcc_jit_lvalue_as_rvalue(field(program, signaturePtr, offsetof(Signature, native), nativeType));
+	storeNative(program, call, result, signature.result,
+		gcc_jit_context_new_call_through_ptr(ctx, nullptr, native, params.size(), params.data()));
+	gcc_jit_block_end_with_jump(call, nullptr, join);
+
+	rtcall(program, fallback, Program::RuntimeFunction::FunctionCall, result, fn, args.size(), generatePointerArray(program, func, fallback, args));
+	gcc_jit_block_end_with_jump(fallback, nullptr, join);
+
+	block = join;
+	return true;
+}
+
+bool nativeBinOp(BinOp::Type op)
+{
+	return any_of(op, BinOp::Type::Plus, BinOp::Type::Minus, BinOp::Type::Times, BinOp::Type::Divide, BinOp::Type::Modulo);
+}
+
+gcc_jit_binary_op nativeBinOpType(BinOp::Type op)
+{
+	switch (op) {
+		case BinOp::Type::Plus:
+			return GCC_JIT_BINARY_OP_PLUS;
+		case BinOp::Type::Minus:
+			return GCC_JIT_BINARY_OP_MINUS;
+		case BinOp::Type::Times:
+			return GCC_JIT_BINARY_OP_MULT;
+		case BinOp::Type::Divide:
+			return GCC_JIT_BINARY_OP_DIVIDE;
+		case BinOp::Type::Modulo:
+			return GCC_JIT_BINARY_OP_MODULO;
+		default:
+			break;
+	}
+
+	assert(false);
+	return GCC_JIT_BINARY_OP_PLUS;
+}
+
+template <typename RuntimeFallback>
+void generateNative(Program &program, gcc_jit_function *func, gcc_jit_block *&block, RValue *result,
+	const RValue *left, TypeSet leftTypes, const RValue *right, TypeSet rightTypes, BinOp::Type op, RuntimeFallback generateRuntime)
+{
+	NativeOperand l = nativeOperand(program, func, block, left, leftTypes);
+	NativeOperand r = nativeOperand(program, func, block, right, rightTypes);
+
+	// Modulo is defined for integers only, reals end up in the runtime error path
+	const TypeSet numbers = TypeSet::numbers();
+	bool mayBeInt = l.types.contains(ValueType::Integer) && r.types.contains(ValueType::Integer);
+	bool mayBeReal = op != BinOp::Type::Modulo && !(l.types & numbers).empty() && !(r.types & numbers).empty()
+		&& (l.types.contains(ValueType::Real) || r.types.contains(ValueType::Real));
+	bool intOnly = l.types == ValueType::Integer && r.types == ValueType::Integer;
+	bool numeric = intOnly || (mayBeReal && l.types.subsetOf(numbers) && r.types.subsetOf(numbers));
+
+	if (!mayBeInt && !mayBeReal) {
+		generateRuntime(block);
+		return;
+	}
+
+	auto ctx = program.context();
+	gcc_jit_block *fallback = numeric ? nullptr : gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *join = gcc_jit_function_new_block(func, nullptr);
+
+	// Where operands that are not both Integer continue
+	gcc_jit_block *realBlock = nullptr;
+	gcc_jit_block *notInt = fallback;
+	if (mayBeReal) {
+		realBlock = gcc_jit_function_new_block(func, nullptr);
+		notInt = realBlock;
+		if (!numeric) {
+			gcc_jit_block *realCheck = gcc_jit_function_new_block(func, nullptr);
+			gcc_jit_block_end_with_conditional(realCheck, nullptr,
+				logicalAnd(program, isNumber(program, l), isNumber(program, r)), realBlock, fallback);
+			notInt = realCheck;
+		}
+	}
+
+	if (mayBeInt) {
+		gcc_jit_block *intBlock = intOnly ? block : gcc_jit_function_new_block(func, nullptr);
+		if (!intOnly) {
+			gcc_jit_block_end_with_conditional(block, nullptr,
+				logicalAnd(program, isType(program, l, ValueType::Integer), isType(program, r, ValueType::Integer)), intBlock, notInt);
+		}
+
+		gcc_jit_rvalue *intResult = gcc_jit_context_new_binary_op(ctx, nullptr, nativeBinOpType(op),
+			program.type(ValueType::Integer), l.intValue, r.intValue);
+		storeNative(program, intBlock, result, ValueType::Integer, intResult);
+		gcc_jit_block_end_with_jump(intBlock, nullptr, join);
+	} else {
+		gcc_jit_block_end_with_jump(block, nullptr, notInt);
+	}
+
+	if (mayBeReal) {
+		gcc_jit_rvalue *realLeft = loadReal(program, func, realBlock, l);
+		gcc_jit_rvalue *realRight = loadReal(program, func, realBlock, r);
+		gcc_jit_rvalue *realResult = gcc_jit_context_new_binary_op(ctx, nullptr, nativeBinOpType(op),
+			program.type(ValueType::Real), realLeft, realRight);
+		storeNative(program, realBlock, result, ValueType::Real, realResult);
+		gcc_jit_block_end_with_jump(realBlock, nullptr, join);
+	}
+
+	if (fallback) {
+		generateRuntime(fallback);
+		gcc_jit_block_end_with_jump(fallback, nullptr, join);
+	}
+
+	block = join;
+}
+
+template <typename RuntimeFallback>
+void generateNative(Program &program, gcc_jit_function *func, gcc_jit_block *&block, RValue *result,
+	const RValue *operand, TypeSet types, RuntimeFallback generateRuntime)
+{
+	NativeOperand o = nativeOperand(program, func, block, operand, types);
+	bool mayBeInt = o.types.contains(ValueType::Integer);
+	bool mayBeReal = o.types.contains(ValueType::Real);
+	bool numeric = o.types.subsetOf(TypeSet::numbers());
+
+	if (!mayBeInt && !mayBeReal) {
+		generateRuntime(block);
+		return;
+	}
+
+	auto ctx = program.context();
+	gcc_jit_block *fallback = numeric ? nullptr : gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *join = gcc_jit_function_new_block(func, nullptr);
+
+	gcc_jit_block *realBlock = nullptr;
+	gcc_jit_block *notInt = fallback;
+	if (mayBeReal) {
+		realBlock = gcc_jit_function_new_block(func, nullptr);
+		notInt = realBlock;
+		if (!numeric) {
+			gcc_jit_block *realCheck = gcc_jit_function_new_block(func, nullptr);
+			gcc_jit_block_end_with_conditional(realCheck, nullptr, isType(program, o, ValueType::Real), realBlock, fallback);
+			notInt = realCheck;
+		}
+	}
+
+	if (mayBeInt) {
+		bool intOnly = o.types == ValueType::Integer;
+		gcc_jit_block *intBlock = intOnly ? block : gcc_jit_function_new_block(func, nullptr);
+		if (!intOnly)
+			gcc_jit_block_end_with_conditional(block, nullptr, isType(program, o, ValueType::Integer), intBlock, notInt);
+
+		storeNative(program, intBlock, result, ValueType::Integer,
+			gcc_jit_context_new_unary_op(ctx, nullptr, GCC_JIT_UNARY_OP_MINUS, program.type(ValueType::Integer), o.intValue));
+		gcc_jit_block_end_with_jump(intBlock, nullptr, join);
+	} else {
+		gcc_jit_block_end_with_jump(block, nullptr, notInt);
+	}
+
+	if (mayBeReal) {
+		storeNative(program, realBlock, result, ValueType::Real,
+			gcc_jit_context_new_unary_op(ctx, nullptr, GCC_JIT_UNARY_OP_MINUS, program.type(ValueType::Real), o.realValue));
+		gcc_jit_block_end_with_jump(realBlock, nullptr, join);
+	}
+
+	if (fallback) {
+		generateRuntime(fallback);
+		gcc_jit_block_end_with_jump(fallback, nullptr, join);
+	}
+
+	block = join;
+}
+
 template <typename T>
 RValue * generateImmediate(Program &program, const RValue *operand, UnOp::Type op)
 {
@@ -241,7 +861,7 @@ RValue * generateImmediate(Program &program, RValue *operand, UnOp::Type op)
 }
 
 template <>
-RValue * generate<Node::Type::UnOp>(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+RValue * generate<Node::Type::UnOp>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	const UnOp *uo = static_cast<const UnOp *>(src);
 	RValue *operand = dispatch(program, func, block, uo->operand());
@@ -250,13 +870,18 @@ RValue * generate<Node::Type::UnOp>(Program &program, gcc_jit_function *func, gc
 	if (operand->type() == RValue::Type::Immediate)
 		return generateImmediate(program, operand, uo->unOpType());
 
-	RValue *result = program.allocRValue();
+	RValue *result = program.allocTemporary();
 
-	RUNCALL(RUNCALL_PUSH, operand);
-	RUNCALL(RUNCALL_PUSH, result);
-	RUNCALL(RUNCALL_UNOP, toVoidPtr(uo->unOpType()));
+	auto generateRuntime = [&](gcc_jit_block *&block) {
+		RTCALL(UnOp, static_cast<int>(uo->unOpType()), result, operand);
+	};
 
-	result->setType(RValue::Type::Temporary);
+	if (uo->unOpType() == UnOp::Type::Negate)
+		generateNative(program, func, block, result, operand, program.typeInference().types(uo->operand()), generateRuntime);
+	else
+		generateRuntime(block);
+
+	program.releaseTemporary(operand);
 	return result;
 }
 
@@ -282,7 +907,7 @@ RValue * generateImmediate(Program &program, RValue *opLeft, RValue *opRight, Bi
 		case ValueType::Real:
 			return generateImmediate<double>(program, opLeft, opRight, op);
 		case ValueType::String:
-			return generateImmediate<std::string>(program, opLeft, opRight, op);
+			return generateImmediate<Atom>(program, opLeft, opRight, op);
 		default:
 			break;
 	}
@@ -292,7 +917,7 @@ RValue * generateImmediate(Program &program, RValue *opLeft, RValue *opRight, Bi
 }
 
 template <>
-RValue * generate<Node::Type::BinOp>(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+RValue * generate<Node::Type::BinOp>(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	const BinOp *bo = static_cast<const BinOp *>(src);
 
@@ -305,18 +930,24 @@ RValue * generate<Node::Type::BinOp>(Program &program, gcc_jit_function *func, g
 	if (left->type() == RValue::Type::Immediate && right->type() == RValue::Type::Immediate)
 		return generateImmediate(program, left, right, bo->binOpType());
 
-	RValue *result = program.allocRValue();
+	RValue *result = program.allocTemporary();
+
+	auto generateRuntime = [&](gcc_jit_block *&block) {
+		RTCALL(BinOp, static_cast<int>(bo->binOpType()), result, left, right);
+	};
 
-	RUNCALL(RUNCALL_PUSH, right);
-	RUNCALL(RUNCALL_PUSH, left);
-	RUNCALL(RUNCALL_PUSH, result);
-	RUNCALL(RUNCALL_BINOP, toVoidPtr(bo->binOpType()));
+	if (nativeBinOp(bo->binOpType()))
+		generateNative(program, func, block, result, left, program.typeInference().types(bo->left()),
+			right, program.typeInference().types(bo->right()), bo->binOpType(), generateRuntime);
+	else
+		generateRuntime(block);
 
-	result->setType(RValue::Type::Temporary);
+	program.releaseTemporary(left);
+	program.releaseTemporary(right);
 	return result;
 }
 
-RValue * dispatch(Program &program, gcc_jit_function *func, gcc_jit_block *block, const Node *src)
+RValue * dispatch(Program &program, gcc_jit_function *func, gcc_jit_block *&block, const Node *src)
 {
 	switch (src->type()) {
 		case Node::Type::Assignment:
@@ -344,6 +975,21 @@ RValue * dispatch(Program &program, gcc_jit_function *func, gcc_jit_block *block
 	return nullptr;
 }
 
+void generateMain(Program &program, const Node *root)
+{
+	gcc_jit_function *func = program.main();
+	gcc_jit_block *entry = gcc_jit_function_new_block(func, "entry");
+	gcc_jit_block *body = gcc_jit_function_new_block(func, nullptr);
+	gcc_jit_block *block = body;
+	dispatch(program, func, block, root);
+
+	// The frame size is only known now, its allocation goes in front of everything else
+	program.enterFrame(entry);
+	gcc_jit_block_end_with_jump(entry, nullptr, body);
+	program.leaveFrame(block);
+	gcc_jit_block_end_with_void_return(block, nullptr);
+}
+
 } //namespace
 
 void generate(const Node *root)
@@ -359,7 +1005,17 @@ void generate(const Node *root)
 	}
 
 	Program &program = Program::getInstance();
-	dispatch(program, program.main(), nullptr, root);
+	program.resolver().resolve(root);
+	program.typeInference().infer(root);
+	generateMain(program, root);
+}
+
+void generateBatch(const Chunk *batch)
+{
+	Program &program = Program::getInstance();
+	program.resolver().resolveBatch(batch);
+	program.typeInference().infer(batch);
+	generateMain(program, batch);
 }
 
 } //namespace Lua
@@ -2,8 +2,11 @@
 
 namespace Lua {
 
+class Chunk;
 class Node;
 
 void generate(const Node *root);
+// Streaming mode: the chunk in batches, each one into its own __main, see Program::nextBatch()
+void generateBatch(const Chunk *batch);
 
 } //namespace Lua
@@ -0,0 +1,246 @@
+#include <vector>
+
+#include "Generator/AST.hpp"
+#include "Generator/Interpreter.hpp"
+#include "Generator/Program.hpp"
+#include "Generator/Runtime.hpp"
+#include "Generator/RValue.hpp"
+#include "Generator/Table.hpp"
+#include "Util/PrettyPrint.hpp"
+
+namespace Lua {
+
+namespace {
+
+/*
+ * Evaluates nodes in the same order as the generated code does and goes
+ * through the same rt_* runtime operations, temporaries live on the C++ stack.
+ */
+class Interpreter {
+public:
+	explicit Interpreter(const Resolver &resolver) : m_resolver{resolver} {}
+
+	void execute(const Node *n);
+	RValue evaluate(const Node *n);
+
+private:
+	std::vector <RValue> evaluateExprList(const ExprList *exprList);
+	RValue evaluateLValue(const LValue *lval, bool assign);
+	RValue evaluateValue(const Value *v);
+	RValue evaluateTable(const TableCtor *tv);
+
+	const Resolver &m_resolver;
+};
+
+void Interpreter::execute(const Node *n)
+{
+	switch (n->type()) {
+		case Node::Type::Chunk: {
+			const Chunk *c = static_cast<const Chunk *>(n);
+			rt_scope_push(m_resolver.slotCount(c));
+			// Temporaries on the C++ stack are no roots, collect only between statements
+			for (const auto &child : c->children()) {
+				execute(child);
+				rt_gc_safepoint();
+			}
+			break;
+		}
+
+		case Node::Type::Assignment: {
+			const Assignment *a = static_cast<const Assignment *>(n);
+			std::vector <RValue> exprResults = evaluateExprList(a->exprList());
+
+			// Same as the generator: with several targets, values read from variables are copied before any store
+			if (a->varList()->vars().size() > 1) {
+				for (RValue &rv : exprResults) {
+					if (rv.type() == RValue::Type::LValue)
+						rv.setValue(rv.value());
+				}
+			}
+
+			size_t i = 0;
+			for (const auto &lval : a->varList()->vars()) {
+				RValue dst = evaluateLValue(lval, true);
+				rt_assign(&dst, i < exprResults.size() ? &exprResults[i] : &RValue::Nil());
+				++i;
+			}
+			break;
+		}
+
+		case Node::Type::FunctionCall:
+			evaluate(n);
+			break;
+
+		default:
+			std::cerr << "interpret() not implemented for statement type: " << prettyPrint(n->type()) << '\n';
+			abort();
+	}
+}
+
+RValue Interpreter::evaluate(const Node *n)
+{
+	switch (n->type()) {
+		case Node::Type::Value:
+			return evaluateValue(static_cast<const Value *>(n));
+
+		case Node::Type::LValue:
+			return evaluateLValue(static_cast<const LValue *>(n), false);
+
+		case Node::Type::TableCtor:
+			return evaluateTable(static_cast<const TableCtor *>(n));
+
+		case Node::Type::FunctionCall: {
+			const FunctionCall *f = static_cast<const FunctionCall *>(n);
+			RValue fn = evaluate(f->functionExpr());
+			std::vector <RValue> args = evaluateExprList(f->args());
+
+			std::vector <RValue *> argPtrs(args.size());
+			for (size_t i = 0; i != args.size(); ++i)
+				argPtrs[i] = &args[i];
+
+			RValue result;
+			rt_function_call(&result, &fn, argPtrs.size(), argPtrs.data());
+			return result;
+		}
+
+		case Node::Type::UnOp: {
+			const UnOp *uo = static_cast<const UnOp *>(n);
+			RValue operand = evaluate(uo->operand());
+			RValue result;
+			rt_unop(static_cast<int>(uo->unOpType()), &result, &operand);
+			return result;
+		}
+
+		case Node::Type::BinOp: {
+			const BinOp *bo = static_cast<const BinOp *>(n);
+			RValue left = evaluate(bo->left());
+			RValue right = evaluate(bo->right());
+			RValue result;
+			rt_binop(static_cast<int>(bo->binOpType()), &result, &left, &right);
+			return result;
+		}
+
+		default:
+			break;
+	}
+
+	std::cerr << "interpret() not implemented for expression type: " << prettyPrint(n->type()) << '\n';
+	abort();
+	return RValue{};
+}
+
+std::vector <RValue> Interpreter::evaluateExprList(const ExprList *exprList)
+{
+	std::vector <RValue> result;
+	result.reserve(exprList->exprs().size());
+	for (const auto &expr : exprList->exprs())
+		result.push_back(evaluate(expr));
+	return result;
+}
+
+// Only assignment targets add missing keys to tables
+RValue Interpreter::evaluateLValue(const LValue *lval, bool assign)
+{
+	RValue result;
+
+	switch (lval->lvalueType()) {
+		case LValue::Type::Bracket:
+		case LValue::Type::Dot: {
+			RValue key = lval->lvalueType() == LValue::Type::Dot ? RValue{lval->name()} : evaluate(lval->keyExpr());
+			RValue table = evaluate(lval->tableExpr());
+			if (assign)
+				rt_table_lvalue(&result, &table, &key);
+			else
+				rt_table_get(&result, &table, &key);
+			break;
+		}
+
+		case LValue::Type::Name: {
+			Resolver::Slot slot = m_resolver.slot(lval);
+			rt_resolve_slot(&result, slot.depth, slot.index);
+			break;
+		}
+	}
+
+	return result;
+}
+
+RValue Interpreter::evaluateValue(const Value *v)
+{
+	switch (v->valueType()) {
+		case ValueType::Nil:
+			return RValue::Nil();
+		case ValueType::Boolean:
+			return RValue{static_cast<const BooleanValue *>(v)->value()};
+		case ValueType::Integer:
+			return RValue{static_cast<const IntValue *>(v)->value()};
+		case ValueType::Real:
+			return RValue{static_cast<const RealValue *>(v)->value()};
+		case ValueType::String:
+			return RValue{static_cast<const StringValue *>(v)->value()};
+		case ValueType::Table:
+			return RValue{Table::create(*static_cast<const TableValue *>(v)->value())};
+		default:
+			break;
+	}
+
+	std::cerr << "interpret() not implemented for value type: " << prettyPrint(v->valueType()) << '\n';
+	abort();
+	return RValue{};
+}
+
+RValue Interpreter::evaluateTable(const TableCtor *tv)
+{
+	// Same field layout as generate<Node::Type::TableCtor>: keyed pairs first, then positional ones
+	std::vector <RValue> positional;
+	std::vector <RValue> keyed;
+	int fieldCounter = 0;
+
+	for (const auto &field : tv->fields()) {
+		if (field->fieldType() == Field::Type::NoIndex) {
+			positional.push_back(RValue{++fieldCounter});
+			positional.push_back(evaluate(field->valueExpr()));
+		}
+	}
+
+	for (const auto &field : tv->fields()) {
+		if (field->fieldType() == Field::Type::Brackets)
+			keyed.push_back(evaluate(field->keyExpr()));
+		else if (field->fieldType() == Field::Type::Literal)
+			keyed.push_back(RValue{field->fieldName()});
+		else
+			continue;
+		keyed.push_back(evaluate(field->valueExpr()));
+	}
+
+	keyed.insert(keyed.end(), positional.begin(), positional.end());
+	std::vector <RValue *> fields(keyed.size());
+	for (size_t i = 0; i != keyed.size(); ++i)
+		fields[i] = &keyed[i];
+
+	RValue result;
+	rt_table_ctor(&result, fieldCounter, tv->fields().size(), fields.data());
+	return result;
+}
+
+} //namespace
+
+void interpret(const Node *root)
+{
+	if (root == nullptr) {
+		std::cerr << "Empty code\n";
+		return;
+	}
+
+	if (root->type() != Node::Type::Chunk) {
+		std::cerr << "Root node should be a Chunk\n";
+		return;
+	}
+
+	Resolver &resolver = Program::getInstance().resolver();
+	resolver.resolve(root);
+
+	Interpreter{resolver}.execute(root);
+}
+
+} //namespace Lua
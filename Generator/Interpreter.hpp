@@ -0,0 +1,10 @@
+#pragma once
+
+namespace Lua {
+
+class Node;
+
+// Runs a chunk by walking the AST, without involving libgccjit
+void interpret(const Node *root);
+
+} //namespace Lua
@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Generator/AST.hpp"
+#include "Generator/Optimizer.hpp"
+#include "Generator/Program.hpp"
+#include "Generator/RValue.hpp"
+#include "Generator/Table.hpp"
+#include "Util/Fold.hpp"
+
+namespace Lua {
+
+namespace {
+
+bool isConstant(const Node *n)
+{
+	return n->type() == Node::Type::Value;
+}
+
+// Tables are references, only scalars may be copied into other expressions
+bool isScalar(const Node *n)
+{
+	return isConstant(n) && static_cast<const Value *>(n)->valueType() != ValueType::Table;
+}
+
+RValue toRValue(const Node *n)
+{
+	const Value *v = static_cast<const Value *>(n);
+
+	switch (v->valueType()) {
+		case ValueType::Nil:
+			return RValue::Nil();
+		case ValueType::Boolean:
+			return RValue{static_cast<const BooleanValue *>(v)->value()};
+		case ValueType::Integer:
+			return RValue{static_cast<const IntValue *>(v)->value()};
+		case ValueType::Real:
+			return RValue{static_cast<const RealValue *>(v)->value()};
+		case ValueType::String:
+			return RValue{static_cast<const StringValue *>(v)->value()};
+		case ValueType::Table:
+			return RValue{static_cast<const TableValue *>(v)->value()};
+		default:
+			break;
+	}
+
+	assert(false);
+	return RValue{};
+}
+
+Value * toNode(const RValue &rv)
+{
+	switch (rv.valueType()) {
+		case ValueType::Nil:
+			return make<NilValue>();
+		case ValueType::Boolean:
+			return make<BooleanValue>(rv.value<bool>());
+		case ValueType::Integer:
+			return make<IntValue>(rv.value<int>());
+		case ValueType::Real:
+			return make<RealValue>(rv.value<double>());
+		case ValueType::String:
+			return make<StringValue>(rv.value<Atom>());
+		default:
+			break;
+	}
+
+	assert(false);
+	return nullptr;
+}
+
+bool isNumber(const RValue &rv)
+{
+	return rv.valueType() == ValueType::Integer || rv.valueType() == ValueType::Real;
+}
+
+/*
+ * Operations that would fail at runtime are left alone, so the error is
+ * still reported after the statements preceding it have run.
+ */
+std::optional <RValue> fold(UnOp::Type op, const RValue &operand)
+{
+	switch (operand.valueType()) {
+		case ValueType::Boolean:
+			if (op == UnOp::Type::Not)
+				return RValue::executeUnOp<bool>(operand, op);
+			break;
+		case ValueType::Integer:
+			if (op == UnOp::Type::Negate)
+				return RValue::executeUnOp<int>(operand, op);
+			break;
+		case ValueType::Real:
+			if (op == UnOp::Type::Negate)
+				return RValue::executeUnOp<double>(operand, op);
+			break;
+		default:
+			break;
+	}
+
+	return std::nullopt;
+}
+
+std::optional <RValue> fold(BinOp::Type op, RValue left, RValue right)
+{
+	if (isNumber(left) && isNumber(right))
+		matchTypes(left, right);
+	else if (left.valueType() != right.valueType())
+		return std::nullopt;
+
+	if (!BinOp::isApplicable(op, left.valueType()))
+		return std::nullopt;
+
+	switch (left.valueType()) {
+		case ValueType::Integer:
+			if (any_of(op, BinOp::Type::Divide, BinOp::Type::Modulo) && right.value<int>() == 0)
+				return std::nullopt;
+			return RValue::executeBinOp<int>(left, right, op);
+		case ValueType::Real:
+			return RValue::executeBinOp<double>(left, right, op);
+		case ValueType::String:
+			return RValue::executeBinOp<Atom>(left, right, op);
+		default:
+			break;
+	}
+
+	return std::nullopt;
+}
+
+} //namespace
+
+void ConstantFolder::statement(Node *&n)
+{
+	if (n->type() != Node::Type::Assignment) {
+		expression(n);
+		return;
+	}
+
+	Assignment *a = static_cast<Assignment *>(n);
+	const auto &exprs = a->exprList()->exprs();
+	exprList(a->exprList());
+
+	// All right hand sides are evaluated before any of the targets changes
+	size_t i = 0;
+	for (const auto &lval : a->varList()->vars()) {
+		if (lval->lvalueType() != LValue::Type::Name)
+			lvalue(lval);
+		else if (i >= exprs.size())
+			m_constants[lval->name()] = RValue::Nil();
+		else if (isScalar(exprs[i]))
+			m_constants[lval->name()] = toRValue(exprs[i]);
+		else
+			m_constants.erase(lval->name());
+		++i;
+	}
+}
+
+void ConstantFolder::expression(Node *&n)
+{
+	switch (n->type()) {
+		case Node::Type::LValue: {
+			LValue *lval = static_cast<LValue *>(n);
+			if (lval->lvalueType() != LValue::Type::Name) {
+				lvalue(lval);
+				break;
+			}
+
+			auto iter = m_constants.find(lval->name());
+			if (iter != m_constants.end())
+				n = toNode(iter->second);
+			break;
+		}
+
+		case Node::Type::FunctionCall: {
+			FunctionCall *f = static_cast<FunctionCall *>(n);
+			expression(f->mutableFunctionExpr());
+			exprList(f->args());
+			break;
+		}
+
+		case Node::Type::TableCtor:
+			tableCtor(n);
+			break;
+
+		case Node::Type::UnOp: {
+			UnOp *uo = static_cast<UnOp *>(n);
+			expression(uo->mutableOperand());
+			if (!isScalar(uo->operand()))
+				break;
+
+			if (auto result = fold(uo->unOpType(), toRValue(uo->operand())))
+				n = toNode(*result);
+			break;
+		}
+
+		case Node::Type::BinOp: {
+			BinOp *bo = static_cast<BinOp *>(n);
+			expression(bo->mutableLeft());
+			expression(bo->mutableRight());
+			if (!isScalar(bo->left()) || !isScalar(bo->right()))
+				break;
+
+			if (auto result = fold(bo->binOpType(), toRValue(bo->left()), toRValue(bo->right())))
+				n = toNode(*result);
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+void ConstantFolder::exprList(ExprList *exprList)
+{
+	for (auto &expr : exprList->exprs())
+		expression(expr);
+}
+
+void ConstantFolder::lvalue(LValue *lval)
+{
+	if (lval->lvalueType() == LValue::Type::Bracket)
+		expression(lval->mutableKeyExpr());
+	expression(lval->mutableTableExpr());
+}
+
+void ConstantFolder::tableCtor(Node *&n)
+{
+	TableCtor *tv = static_cast<TableCtor *>(n);
+
+	bool constant = true;
+	for (auto &field : tv->fields()) {
+		if (field->fieldType() == Field::Type::Brackets) {
+			expression(field->mutableKeyExpr());
+			// Indexing with nil is a runtime error
+			constant = constant && isScalar(field->keyExpr())
+				&& static_cast<const Value *>(field->keyExpr())->valueType() != ValueType::Nil;
+		}
+
+		// The prebuilt table is copied shallowly, nested tables must not be shared
+		expression(field->mutableValueExpr());
+		constant = constant && isScalar(field->valueExpr());
+	}
+
+	if (!constant)
+		return;
+
+	// Same order as rt_table_ctor() gets the fields in: positional entries win on conflicting keys
+	Table *table = Table::createPinned();
+	for (const auto &field : tv->fields()) {
+		if (field->fieldType() == Field::Type::Brackets)
+			table->setValue(toRValue(field->keyExpr()), toRValue(field->valueExpr()));
+		else if (field->fieldType() == Field::Type::Literal)
+			table->setValue(RValue{field->fieldName()}, toRValue(field->valueExpr()));
+	}
+
+	int fieldCounter = 0;
+	for (const auto &field : tv->fields()) {
+		if (field->fieldType() == Field::Type::NoIndex)
+			table->setValue(RValue{++fieldCounter}, toRValue(field->valueExpr()));
+	}
+
+	// The prebuilt table stays pinned, the script gets a collectable copy of it, see rt_table_clone()
+	n = make<TableValue>(table);
+}
+
+namespace {
+
+void collectReads(const Node *n, std::unordered_set <Atom> &reads)
+{
+	switch (n->type()) {
+		case Node::Type::Chunk:
+			for (const auto &child : static_cast<const Chunk *>(n)->children())
+				collectReads(child, reads);
+			break;
+
+		case Node::Type::ExprList:
+			for (const auto &expr : static_cast<const ExprList *>(n)->exprs())
+				collectReads(expr, reads);
+			break;
+
+		case Node::Type::Assignment: {
+			const Assignment *a = static_cast<const Assignment *>(n);
+			collectReads(a->exprList(), reads);
+			for (const auto &lval : a->varList()->vars()) {
+				// Storing to a name is not a read, indexing a table held by one is
+				if (lval->lvalueType() != LValue::Type::Name)
+					collectReads(lval, reads);
+			}
+			break;
+		}
+
+		case Node::Type::LValue: {
+			const LValue *lval = static_cast<const LValue *>(n);
+			if (lval->lvalueType() == LValue::Type::Name) {
+				reads.insert(lval->name());
+				break;
+			}
+
+			if (lval->lvalueType() == LValue::Type::Bracket)
+				collectReads(lval->keyExpr(), reads);
+			collectReads(lval->tableExpr(), reads);
+			break;
+		}
+
+		case Node::Type::FunctionCall: {
+			const FunctionCall *f = static_cast<const FunctionCall *>(n);
+			collectReads(f->functionExpr(), reads);
+			collectReads(f->args(), reads);
+			break;
+		}
+
+		case Node::Type::TableCtor:
+			for (const auto &field : static_cast<const TableCtor *>(n)->fields()) {
+				if (field->fieldType() == Field::Type::Brackets)
+					collectReads(field->keyExpr(), reads);
+				collectReads(field->valueExpr(), reads);
+			}
+			break;
+
+		case Node::Type::BinOp: {
+			const BinOp *bo = static_cast<const BinOp *>(n);
+			collectReads(bo->left(), reads);
+			collectReads(bo->right(), reads);
+			break;
+		}
+
+		case Node::Type::UnOp:
+			collectReads(static_cast<const UnOp *>(n)->operand(), reads);
+			break;
+
+		default:
+			break;
+	}
+}
+
+// Constant stores to globals nobody reads any more can go, the chunk is the whole program
+void removeDeadStores(Chunk *c)
+{
+	std::unordered_set <Atom> reads;
+	collectReads(c, reads);
+
+	for (auto &n : c->children()) {
+		if (n->type() != Node::Type::Assignment)
+			continue;
+
+		Assignment *a = static_cast<Assignment *>(n);
+		auto &vars = a->varList()->vars();
+		auto &exprs = a->exprList()->exprs();
+
+		// Compacts both lists in place, a target and its expression go together
+		size_t liveVars = 0;
+		size_t liveExprs = 0;
+		for (size_t i = 0; i != vars.size(); ++i) {
+			bool hasExpr = i < exprs.size();
+			bool dead = vars[i]->lvalueType() == LValue::Type::Name && reads.count(vars[i]->name()) == 0
+				&& (!hasExpr || isConstant(exprs[i]));
+			if (dead)
+				continue;
+
+			vars[liveVars++] = vars[i];
+			if (hasExpr)
+				exprs[liveExprs++] = exprs[i];
+		}
+
+		// Surplus expressions are evaluated for their side effects only
+		for (size_t i = vars.size(); i < exprs.size(); ++i) {
+			if (!isConstant(exprs[i]))
+				exprs[liveExprs++] = exprs[i];
+		}
+
+		vars.truncate(liveVars);
+		exprs.truncate(liveExprs);
+	}
+
+	c->children().removeIf([](const Node *n) {
+		if (n->type() != Node::Type::Assignment)
+			return false;
+		const Assignment *a = static_cast<const Assignment *>(n);
+		return a->varList()->vars().empty() && a->exprList()->exprs().empty();
+	});
+}
+
+} //namespace
+
+void optimize(Node *root)
+{
+	if (root == nullptr || root->type() != Node::Type::Chunk)
+		return;
+
+	Chunk *c = static_cast<Chunk *>(root);
+	ConstantFolder folder;
+	for (auto &n : c->children())
+		folder.statement(n);
+
+	removeDeadStores(c);
+}
+
+void optimizeBatch(Chunk *batch)
+{
+	ConstantFolder &folder = Program::getInstance().constantFolder();
+	for (auto &n : batch->children())
+		folder.statement(n);
+}
+
+} //namespace Lua
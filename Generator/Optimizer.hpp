@@ -0,0 +1,40 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "Generator/Atom.hpp"
+#include "Generator/RValue.hpp"
+
+namespace Lua {
+
+class Chunk;
+class ExprList;
+class LValue;
+class Node;
+
+/*
+ * Chunks are straight-line code, so the value a global holds is known at
+ * every statement: walking the statements in order and recording constant
+ * stores is enough to propagate them into later reads. In streaming mode
+ * the Program keeps the one folding all its batches.
+ */
+class ConstantFolder {
+public:
+	void statement(Node *&n);
+
+private:
+	void expression(Node *&n);
+	void exprList(ExprList *exprList);
+	void lvalue(LValue *lval);
+	void tableCtor(Node *&n);
+
+	// Known values of globals at the current statement
+	std::unordered_map <Atom, RValue> m_constants;
+};
+
+// Folds and propagates constants, rewriting the tree in place before codegen
+void optimize(Node *root);
+// Streaming mode: batches of one chunk in order, constants carry over and no store is dead as later batches may read it
+void optimizeBatch(Chunk *batch);
+
+} //namespace Lua
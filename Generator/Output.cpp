@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+#include "Generator/Output.hpp"
+
+namespace {
+
+constexpr size_t DefaultBufferSize = 64 * 1024;
+// Longest number to_chars() produces here, a %g double with 6 digits
+constexpr size_t MaxNumberSize = 32;
+
+void flushAtExit()
+{
+	Output::stdOut().flush();
+}
+
+} //namespace
+
+Output & Output::stdOut()
+{
+	// Never destroyed, it is still written to by atexit handlers
+	static Output *output = new Output{STDOUT_FILENO};
+	return *output;
+}
+
+Output::Output(int fd) : m_fd{fd}, m_lineBuffered{isatty(fd) != 0}
+{
+	size_t size = DefaultBufferSize;
+	if (const char *env = getenv("THEJITTER_OUTPUT_BUFFER"); env && *env)
+		size = strtoull(env, nullptr, 10);
+	m_buffer.resize(std::max(size, MaxNumberSize));
+
+	atexit(flushAtExit);
+}
+
+void Output::write(std::string_view s)
+{
+	// Too long to be worth copying, goes out on its own
+	if (s.size() > m_buffer.size()) {
+		flush();
+		for (size_t done = 0; done != s.size(); ) {
+			ssize_t n = ::write(m_fd, s.data() + done, s.size() - done);
+			if (n <= 0)
+				return;
+			done += n;
+		}
+		return;
+	}
+
+	std::memcpy(reserve(s.size()), s.data(), s.size());
+	m_size += s.size();
+	if (m_lineBuffered && s.find('\n') != std::string_view::npos)
+		flush();
+}
+
+void Output::write(char c)
+{
+	*reserve(1) = c;
+	++m_size;
+	if (c == '\n')
+		lineDone();
+}
+
+void Output::write(int v)
+{
+	char *first = reserve(MaxNumberSize);
+	m_size = std::to_chars(first, first + MaxNumberSize, v).ptr - m_buffer.data();
+}
+
+void Output::write(double v)
+{
+	char *first = reserve(MaxNumberSize);
+	m_size = std::to_chars(first, first + MaxNumberSize, v, std::chars_format::general, 6).ptr - m_buffer.data();
+}
+
+void Output::write(bool v)
+{
+	write(v ? std::string_view{"true"} : std::string_view{"false"});
+}
+
+void Output::write(const void *p)
+{
+	write(std::string_view{"0x"});
+	char *first = reserve(MaxNumberSize);
+	m_size = std::to_chars(first, first + MaxNumberSize, reinterpret_cast<uintptr_t>(p), 16).ptr - m_buffer.data();
+}
+
+void Output::flush()
+{
+	std::cout.flush();
+
+	size_t done = 0;
+	while (done != m_size) {
+		ssize_t n = ::write(m_fd, m_buffer.data() + done, m_size - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	m_size = 0;
+}
+
+char * Output::reserve(size_t n)
+{
+	if (m_size + n > m_buffer.size())
+		flush();
+	return m_buffer.data() + m_size;
+}
+
+void Output::lineDone()
+{
+	if (m_lineBuffered)
+		flush();
+}
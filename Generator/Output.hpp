@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/*
+ * Buffered standard output of the running code, print and any other
+ * builtin writing to stdout go through it. Numbers are formatted with
+ * std::to_chars straight into the buffer, which is handed to write(2) in
+ * one piece when full, at explicit flush() calls and at exit. A terminal
+ * is flushed at every newline instead.
+ *
+ * The buffer size is taken from THEJITTER_OUTPUT_BUFFER (bytes, default
+ * 64 KiB). Whatever was written to std::cout goes out first, code mixing
+ * the two has to flush() before using std::cout.
+ */
+class Output {
+public:
+	static Output & stdOut();
+
+	Output(const Output &) = delete;
+	Output & operator = (const Output &) = delete;
+
+	void write(std::string_view s);
+	void write(char c);
+	void write(int v);
+	// Formatted like std::ostream does by default, %g with 6 digits
+	void write(double v);
+	void write(bool v);
+	void write(const void *p);
+
+	void flush();
+
+private:
+	explicit Output(int fd);
+
+	// Room for n more bytes, flushing if there isn't
+	char * reserve(size_t n);
+	void lineDone();
+
+	int m_fd;
+	bool m_lineBuffered;
+	std::vector <char> m_buffer;
+	size_t m_size = 0;
+};
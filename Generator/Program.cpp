@@ -1,47 +1,198 @@
 #include <algorithm>
 #include <array>
+#include <cassert>
+#include <iostream>
 
 #include "Generator/Program.hpp"
 
 Program::Program()
-	: m_jitCtx{gcc_jit_context_acquire(), gcc_jit_context_release}
+	: m_jitCtx{gcc_jit_context_acquire(), gcc_jit_context_release}, m_optimizationLevel{0}, m_dumpGimple{true}
 {
 	prepareTypes();
+	prepareRuntime();
+	prepareMain();
+}
+
+void Program::nextBatch()
+{
+	// The previous batch has run and its code is gone, only the literals of the next one are needed
+	m_jitCtx.reset(gcc_jit_context_acquire());
+	m_rvaluePool.clear();
+	m_rvalueTable.clear();
+	m_temporaries.clear();
+	m_temporarySlots.clear();
+	m_freeTemporaries.clear();
+	m_inlineCacheCount = 0;
+	m_usesBuiltins = false;
+	++m_batch;
 
-	gcc_jit_param *runtime = gcc_jit_context_new_param(m_jitCtx.get(), nullptr, m_runcallPtrType, "__runtime");
+	prepareTypes();
+	prepareRuntime();
+	prepareMain();
+}
+
+void Program::prepareMain()
+{
+	gcc_jit_type *rvalueTableType = gcc_jit_type_get_pointer(type(ValueType::Unknown));
+	gcc_jit_param *rvalueTable = gcc_jit_context_new_param(m_jitCtx.get(), nullptr, rvalueTableType, "__rvalues");
 	m_mainFunc = gcc_jit_context_new_function(
 		m_jitCtx.get(), nullptr, GCC_JIT_FUNCTION_EXPORTED,
-		type(ValueType::Nil), "__main", 1, &runtime, 0);
+		type(ValueType::Nil), "__main", 1, &rvalueTable, 0);
 
-	m_runcallPtr = gcc_jit_param_as_rvalue(runtime);
+	m_rvalueTablePtr = gcc_jit_param_as_rvalue(rvalueTable);
+	m_frame = gcc_jit_function_new_local(m_mainFunc, nullptr, type(ValueType::Unknown), "__frame");
+	m_caches = gcc_jit_function_new_local(m_mainFunc, nullptr, type(ValueType::Unknown), "__caches");
+	m_builtins = gcc_jit_function_new_local(m_mainFunc, nullptr, type(ValueType::Unknown), "__builtins");
 }
 
 gcc_jit_result * Program::compile() const
 {
-	gcc_jit_context_set_bool_option(m_jitCtx.get(), GCC_JIT_BOOL_OPTION_DUMP_INITIAL_GIMPLE, true);
+	applyOptions();
 	return gcc_jit_context_compile(m_jitCtx.get());
 }
 
+Program::EntryPoint Program::compileEntryPoint() const
+{
+	gcc_jit_result *result = compile();
+	if (result == nullptr)
+		return nullptr;
+	return reinterpret_cast<EntryPoint>(gcc_jit_result_get_code(result, "__main"));
+}
+
+std::string Program::optionsKey() const
+{
+	return "O" + std::to_string(m_optimizationLevel) + (m_dumpGimple ? ",dump-initial-gimple" : "");
+}
+
+bool Program::compileToFile(const std::string &path) const
+{
+	applyOptions();
+	gcc_jit_context_compile_to_file(m_jitCtx.get(), GCC_JIT_OUTPUT_KIND_DYNAMIC_LIBRARY, path.c_str());
+	return gcc_jit_context_get_first_error(m_jitCtx.get()) == nullptr;
+}
+
+void Program::applyOptions() const
+{
+	gcc_jit_context_set_int_option(m_jitCtx.get(), GCC_JIT_INT_OPTION_OPTIMIZATION_LEVEL, m_optimizationLevel);
+	gcc_jit_context_set_bool_option(m_jitCtx.get(), GCC_JIT_BOOL_OPTION_DUMP_INITIAL_GIMPLE, m_dumpGimple);
+}
+
 gcc_jit_type * Program::type(ValueType t) const
 {
 	return m_basicTypes[toUnderlying(t)];
 }
 
+gcc_jit_type * Program::pointerArrayType(size_t size)
+{
+	return gcc_jit_context_new_array_type(m_jitCtx.get(), nullptr, type(ValueType::Unknown), size);
+}
+
+gcc_jit_rvalue * Program::rvalueRef(const RValue *rvalue)
+{
+	auto ctx = m_jitCtx.get();
+
+	auto temporary = m_temporarySlots.find(rvalue);
+	if (temporary != m_temporarySlots.end()) {
+		// &((char *) __frame)[slot * sizeof(RValue)]
+		gcc_jit_type *bytePtrType = gcc_jit_type_get_pointer(gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CHAR));
+		gcc_jit_rvalue *base = gcc_jit_context_new_cast(ctx, nullptr, gcc_jit_lvalue_as_rvalue(m_frame), bytePtrType);
+		gcc_jit_rvalue *offset = gcc_jit_context_new_rvalue_from_long(ctx, m_sizeType, temporary->second * sizeof(RValue));
+		gcc_jit_lvalue *slot = gcc_jit_context_new_array_access(ctx, nullptr, base, offset);
+		return gcc_jit_context_new_cast(ctx, nullptr, gcc_jit_lvalue_get_address(slot, nullptr), type(ValueType::Unknown));
+	}
+
+	size_t position = m_rvaluePool.indexOf(rvalue);
+	assert(position != m_rvaluePool.size());
+
+	gcc_jit_rvalue *index = gcc_jit_context_new_rvalue_from_long(ctx, m_sizeType, position);
+	return gcc_jit_lvalue_as_rvalue(gcc_jit_context_new_array_access(ctx, nullptr, m_rvalueTablePtr, index));
+}
+
 RValue * Program::allocRValue(const RValue &src)
 {
-	m_rvaluePool.push_back(std::make_unique<RValue>(src));
-	return m_rvaluePool.back().get();
+	RValue *result = m_rvaluePool.create(src);
+	m_rvalueTable.push_back(result);
+	return result;
+}
+
+RValue * Program::allocTemporary()
+{
+	if (!m_freeTemporaries.empty()) {
+		RValue *result = m_freeTemporaries.back();
+		m_freeTemporaries.pop_back();
+		// The generator reads lvalues through their pointer, a reused slot must not look like one
+		result->setType(RValue::Type::Temporary);
+		return result;
+	}
+
+	m_temporaries.push_back(std::make_unique<RValue>());
+	RValue *result = m_temporaries.back().get();
+	result->setType(RValue::Type::Temporary);
+	m_temporarySlots.emplace(result, m_temporaries.size() - 1);
+	return result;
+}
+
+void Program::releaseTemporary(const RValue *rvalue)
+{
+	// Literals stay in the RValue table for good
+	auto iter = m_temporarySlots.find(rvalue);
+	if (iter == m_temporarySlots.end())
+		return;
+
+	RValue *temporary = m_temporaries[iter->second].get();
+	assert(std::find(m_freeTemporaries.begin(), m_freeTemporaries.end(), temporary) == m_freeTemporaries.end());
+	m_freeTemporaries.push_back(temporary);
+}
+
+void Program::enterFrame(gcc_jit_block *block)
+{
+	gcc_jit_rvalue *size = gcc_jit_context_new_rvalue_from_long(m_jitCtx.get(), m_sizeType, frameSize());
+	gcc_jit_rvalue *call = gcc_jit_context_new_call(m_jitCtx.get(), nullptr, runtimeFunction(RuntimeFunction::FrameEnter), 1, &size);
+	gcc_jit_block_add_assignment(block, nullptr, m_frame, call);
+
+	if (m_inlineCacheCount > 0) {
+		gcc_jit_rvalue *count = gcc_jit_context_new_rvalue_from_long(m_jitCtx.get(), m_sizeType, m_inlineCacheCount);
+		gcc_jit_block_add_assignment(block, nullptr, m_caches,
+			gcc_jit_context_new_call(m_jitCtx.get(), nullptr, runtimeFunction(RuntimeFunction::InlineCaches), 1, &count));
+	}
+
+	if (m_usesBuiltins) {
+		gcc_jit_block_add_assignment(block, nullptr, m_builtins,
+			gcc_jit_context_new_call(m_jitCtx.get(), nullptr, runtimeFunction(RuntimeFunction::Builtins), 0, nullptr));
+	}
 }
 
-std::string * Program::duplicateString(const char *s)
+void Program::leaveFrame(gcc_jit_block *block)
 {
-	m_stringPool.push_back(std::make_unique<std::string>(s));
-	return m_stringPool.back().get();
+	gcc_jit_block_add_eval(block, nullptr, gcc_jit_context_new_call(m_jitCtx.get(), nullptr, runtimeFunction(RuntimeFunction::FrameLeave), 0, nullptr));
 }
 
-std::string * Program::duplicateString(const std::string &s)
+bool Program::saveRValues(std::ostream &os) const
 {
-	return duplicateString(s.data());
+	uint64_t count = m_rvalueTable.size();
+	os.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	for (const RValue *rv : m_rvalueTable) {
+		if (!serialize(os, *rv))
+			return false;
+	}
+	return os.good();
+}
+
+bool Program::loadRValues(std::istream &is)
+{
+	uint64_t count;
+	if (!is.read(reinterpret_cast<char *>(&count), sizeof(count)))
+		return false;
+
+	std::vector <RValue> loaded(count);
+	for (RValue &rv : loaded) {
+		if (!deserialize(is, rv))
+			return false;
+	}
+
+	for (const RValue &rv : loaded)
+		allocRValue(rv);
+	return true;
 }
 
 void Program::prepareTypes()
@@ -56,11 +207,44 @@ void Program::prepareTypes()
 	m_basicTypes[toUnderlying(ValueType::String)] = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_CONST_CHAR_PTR);
 	m_basicTypes[toUnderlying(ValueType::Unknown)] = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_VOID_PTR);
 
-	gcc_jit_type *runcall_param_types[2] = {
-		m_basicTypes[toUnderlying(ValueType::Integer)],
-		m_basicTypes[toUnderlying(ValueType::Unknown)],
+	m_sizeType = gcc_jit_context_get_type(ctx, GCC_JIT_TYPE_SIZE_T);
+}
+
+void Program::prepareRuntime()
+{
+	auto ctx = m_jitCtx.get();
+	gcc_jit_type *voidType = type(ValueType::Nil);
+	gcc_jit_type *intType = type(ValueType::Integer);
+	gcc_jit_type *ptrType = type(ValueType::Unknown);
+	gcc_jit_type *ptrArrayType = gcc_jit_type_get_pointer(ptrType);
+
+	auto import = [&](RuntimeFunction f, const char *name, std::initializer_list <gcc_jit_type *> paramTypes, gcc_jit_type *returnType = nullptr) {
+		std::vector <gcc_jit_param *> params;
+		for (gcc_jit_type *t : paramTypes)
+			params.push_back(gcc_jit_context_new_param(ctx, nullptr, t, "arg"));
+
+		m_runtimeFunctions[toUnderlying(f)] = gcc_jit_context_new_function(ctx, nullptr, GCC_JIT_FUNCTION_IMPORTED,
+			returnType ? returnType : voidType, name, params.size(), params.data(), 0);
 	};
 
-	m_runcallPtrType = gcc_jit_context_new_function_ptr_type(ctx, nullptr,
-		m_basicTypes[toUnderlying(ValueType::Unknown)], 2, runcall_param_types, 0);
+	import(RuntimeFunction::ScopePush, "rt_scope_push", {m_sizeType});
+	import(RuntimeFunction::ScopePop, "rt_scope_pop", {});
+	import(RuntimeFunction::ScopeGrow, "rt_scope_grow", {m_sizeType});
+	import(RuntimeFunction::ResolveSlot, "rt_resolve_slot", {ptrType, m_sizeType, m_sizeType});
+	import(RuntimeFunction::Assign, "rt_assign", {ptrType, ptrType});
+	import(RuntimeFunction::UnOp, "rt_unop", {intType, ptrType, ptrType});
+	import(RuntimeFunction::BinOp, "rt_binop", {intType, ptrType, ptrType, ptrType});
+	import(RuntimeFunction::FunctionCall, "rt_function_call", {ptrType, ptrType, m_sizeType, ptrArrayType});
+	import(RuntimeFunction::TableCtor, "rt_table_ctor", {ptrType, m_sizeType, m_sizeType, ptrArrayType});
+	import(RuntimeFunction::TableClone, "rt_table_clone", {ptrType, ptrType, m_sizeType, ptrArrayType});
+	import(RuntimeFunction::TableGet, "rt_table_get", {ptrType, ptrType, ptrType});
+	import(RuntimeFunction::TableGetCached, "rt_table_get_cached", {ptrType, ptrType, ptrType, ptrType});
+	import(RuntimeFunction::TableLValue, "rt_table_lvalue", {ptrType, ptrType, ptrType});
+	import(RuntimeFunction::TableLValueCached, "rt_table_lvalue_cached", {ptrType, ptrType, ptrType, ptrType});
+	import(RuntimeFunction::FrameEnter, "rt_frame_enter", {m_sizeType}, ptrType);
+	import(RuntimeFunction::FrameLeave, "rt_frame_leave", {});
+	import(RuntimeFunction::InlineCaches, "rt_inline_caches", {m_sizeType}, ptrType);
+	import(RuntimeFunction::GcSafepoint, "rt_gc_safepoint", {});
+	import(RuntimeFunction::GcBarrier, "rt_gc_barrier", {ptrType});
+	import(RuntimeFunction::Builtins, "rt_builtins", {}, ptrType);
 }
@@ -1,15 +1,50 @@
 #pragma once
 
+#include <array>
+#include <iosfwd>
 #include <libgccjit.h>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include "Generator/Optimizer.hpp"
+#include "Generator/Resolver.hpp"
 #include "Generator/RValue.hpp"
+#include "Generator/TypeInference.hpp"
 #include "Generator/ValueType.hpp"
+#include "Util/Arena.hpp"
 #include "Util/EnumHelpers.hpp"
 
 class Program {
 public:
+	// Runtime entry points (see Runtime.hpp) imported into the JIT context
+	enum class RuntimeFunction {
+		ScopePush,
+		ScopePop,
+		ScopeGrow,
+		ResolveSlot,
+		Assign,
+		UnOp,
+		BinOp,
+		FunctionCall,
+		TableCtor,
+		TableClone,
+		TableGet,
+		TableGetCached,
+		TableLValue,
+		TableLValueCached,
+		FrameEnter,
+		FrameLeave,
+		InlineCaches,
+		GcSafepoint,
+		GcBarrier,
+		Builtins,
+		_last,
+	};
+
+	// Generated code addresses RValues through this table, never by raw address
+	typedef void (*EntryPoint)(RValue **rvalues);
+
 	static Program & getInstance()
 	{
 		static Program instance;
@@ -18,26 +53,82 @@ public:
 
 	Program();
 
+	// Streaming mode: starts the function of the next batch of statements in a fresh JIT context
+	void nextBatch();
+	// Index of the batch being generated, always 0 when the chunk is generated at once
+	size_t batch() const { return m_batch; }
+
 	gcc_jit_result * compile() const;
+	EntryPoint compileEntryPoint() const;
+	bool compileToFile(const std::string &path) const;
+	std::string optionsKey() const;
+
+	int optimizationLevel() const { return m_optimizationLevel; }
+	void setOptimizationLevel(int level) { m_optimizationLevel = level; }
+	bool dumpGimple() const { return m_dumpGimple; }
+	void setDumpGimple(bool dump) { m_dumpGimple = dump; }
 	gcc_jit_context * context() { return m_jitCtx.get(); }
 	gcc_jit_function * main() { return m_mainFunc; }
-	gcc_jit_rvalue * runtimeCallPtr() { return m_runcallPtr; }
+	Lua::Resolver & resolver() { return m_resolver; }
+	Lua::TypeInference & typeInference() { return m_typeInference; }
+	Lua::ConstantFolder & constantFolder() { return m_constantFolder; }
+	gcc_jit_function * runtimeFunction(RuntimeFunction f) const { return m_runtimeFunctions[toUnderlying(f)]; }
 	gcc_jit_type * type(ValueType t) const;
+	gcc_jit_type * sizeType() const { return m_sizeType; }
+	gcc_jit_type * pointerArrayType(size_t size);
+	gcc_jit_rvalue * rvalueRef(const RValue *rvalue);
 
 	RValue * allocRValue(const RValue &src = RValue{});
-	std::string * duplicateString(const char *s);
-	std::string * duplicateString(const std::string &s);
+
+	// Temporaries live in a per-call frame owned by the runtime, released slots are reused
+	RValue * allocTemporary();
+	void releaseTemporary(const RValue *rvalue);
+	size_t frameSize() const { return m_temporaries.size(); }
+	void enterFrame(gcc_jit_block *block);
+
+	// Inline cache cells are owned by the runtime, the code finds them through __caches
+	size_t allocInlineCache() { return m_inlineCacheCount++; }
+	gcc_jit_rvalue * inlineCaches() const { return gcc_jit_lvalue_as_rvalue(m_caches); }
+	// The builtins() table, for direct calls of typed bindings
+	gcc_jit_rvalue * builtins() { m_usesBuiltins = true; return gcc_jit_lvalue_as_rvalue(m_builtins); }
+	void leaveFrame(gcc_jit_block *block);
+
+	RValue ** rvalues() { return m_rvalueTable.data(); }
+	bool saveRValues(std::ostream &os) const;
+	bool loadRValues(std::istream &is);
 private:
 	void prepareTypes();
+	void prepareRuntime();
+	void prepareMain();
+	void applyOptions() const;
 	void releaseMemory();
 
 	std::unique_ptr <gcc_jit_context, decltype(&gcc_jit_context_release)> m_jitCtx;
+	int m_optimizationLevel;
+	bool m_dumpGimple;
+	size_t m_batch = 0;
 
 	std::array <gcc_jit_type *, toUnderlying(ValueType::_last)> m_basicTypes;
-	gcc_jit_type *m_runcallPtrType;
-	gcc_jit_rvalue *m_runcallPtr;
+	gcc_jit_type *m_sizeType;
+	std::array <gcc_jit_function *, toUnderlying(RuntimeFunction::_last)> m_runtimeFunctions;
 	gcc_jit_function *m_mainFunc;
+	gcc_jit_rvalue *m_rvalueTablePtr;
+	gcc_jit_lvalue *m_frame;
+	gcc_jit_lvalue *m_caches;
+	size_t m_inlineCacheCount = 0;
+	gcc_jit_lvalue *m_builtins;
+	bool m_usesBuiltins = false;
+
+	Lua::Resolver m_resolver;
+	Lua::TypeInference m_typeInference;
+	Lua::ConstantFolder m_constantFolder;
+
+	// Literals, laid out contiguously and released together with the Program
+	Arena <RValue> m_rvaluePool;
+	std::vector <RValue *> m_rvalueTable;
 
-	std::vector <std::unique_ptr <RValue> > m_rvaluePool;
-	std::vector <std::unique_ptr <std::string> > m_stringPool;
+	// Compile time stand-ins for frame slots, one per slot
+	std::vector <std::unique_ptr <RValue> > m_temporaries;
+	std::unordered_map <const RValue *, size_t> m_temporarySlots;
+	std::vector <RValue *> m_freeTemporaries;
 };
@@ -1,17 +1,35 @@
+#include <cstdint>
 #include <iostream>
 
 #include "Generator/RValue.hpp"
+#include "Generator/Table.hpp"
 #include "Util/PrettyPrint.hpp"
 
+const RValue::Layout & RValue::layout()
+{
+	static const Layout result = []{
+		const RValue base;
+		auto offset = [&base](const void *member) -> size_t {
+			return static_cast<const char *>(member) - reinterpret_cast<const char *>(&base);
+		};
+
+		Layout layout;
+		layout.type = offset(&base.m_type);
+		layout.lvalue = offset(&base.m_lvalue);
+		layout.value = offset(&base.m_value);
+		return layout;
+	}();
+
+	return result;
+}
+
 void matchTypes(RValue &leftRValue, RValue &rightRValue)
 {
 	if (leftRValue.valueType() == ValueType::Integer && rightRValue.valueType() == ValueType::Real) {
-		leftRValue.setValueType(ValueType::Real);
 		leftRValue.setValue<double>(leftRValue.value<int>());
 	}
 
 	if (leftRValue.valueType() == ValueType::Real && rightRValue.valueType() == ValueType::Integer) {
-		rightRValue.setValueType(ValueType::Real);
 		rightRValue.setValue<double>(rightRValue.value<int>());
 	}
 
@@ -21,6 +39,117 @@ void matchTypes(RValue &leftRValue, RValue &rightRValue)
 	}
 }
 
+namespace {
+
+template <typename T>
+void write(std::ostream &os, const T &v)
+{
+	os.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template <typename T>
+bool read(std::istream &is, T &v)
+{
+	return static_cast<bool>(is.read(reinterpret_cast<char *>(&v), sizeof(v)));
+}
+
+} //namespace
+
+bool serialize(std::ostream &os, const RValue &rv)
+{
+	write(os, static_cast<uint8_t>(rv.type()));
+	write(os, static_cast<uint8_t>(rv.valueType()));
+
+	switch (rv.valueType()) {
+		case ValueType::Invalid:
+		case ValueType::Nil:
+			break;
+		case ValueType::Boolean:
+			write(os, static_cast<uint8_t>(rv.value<bool>()));
+			break;
+		case ValueType::Integer:
+			write(os, rv.value<int>());
+			break;
+		case ValueType::Real:
+			write(os, rv.value<double>());
+			break;
+		case ValueType::String: {
+			const std::string &s = rv.value<Atom>().str();
+			write(os, static_cast<uint64_t>(s.size()));
+			os.write(s.data(), s.size());
+			break;
+		}
+		case ValueType::Table:
+			if (!serialize(os, *rv.value<Table *>()))
+				return false;
+			break;
+		default:
+			std::cerr << "Unable to serialize value of type " << prettyPrint(rv.valueType()) << '\n';
+			return false;
+	}
+
+	return os.good();
+}
+
+bool deserialize(std::istream &is, RValue &rv)
+{
+	uint8_t type, valueType;
+	if (!read(is, type) || !read(is, valueType))
+		return false;
+
+	switch (static_cast<ValueType>(valueType)) {
+		case ValueType::Invalid:
+			rv = RValue{};
+			break;
+		case ValueType::Nil:
+			rv = RValue::Nil();
+			break;
+		case ValueType::Boolean: {
+			uint8_t v;
+			if (!read(is, v))
+				return false;
+			rv = RValue{static_cast<bool>(v)};
+			break;
+		}
+		case ValueType::Integer: {
+			int v;
+			if (!read(is, v))
+				return false;
+			rv = RValue{v};
+			break;
+		}
+		case ValueType::Real: {
+			double v;
+			if (!read(is, v))
+				return false;
+			rv = RValue{v};
+			break;
+		}
+		case ValueType::String: {
+			uint64_t size;
+			if (!read(is, size))
+				return false;
+			std::string v(size, '\0');
+			if (!is.read(v.data(), size))
+				return false;
+			rv = RValue{Atom{v}};
+			break;
+		}
+		case ValueType::Table: {
+			Table *table = Table::createPinned();
+			if (!deserialize(is, *table))
+				return false;
+			rv = RValue{table};
+			break;
+		}
+		default:
+			return false;
+	}
+
+	rv.setType(static_cast<RValue::Type>(type));
+	return true;
+}
+
 std::ostream & operator << (std::ostream &os, const RValue &rv)
 {
 	os << "RValue(" << rv.value() << ')';
@@ -1,7 +1,6 @@
 #pragma once
 
 #include <libgccjit.h>
-#include <variant>
 
 #include "Generator/AST.hpp"
 #include "Generator/Variable.hpp"
@@ -18,6 +17,16 @@ public:
 		_last,
 	};
 
+	// Byte offsets of the RValue type, lvalue pointer and NaN-boxed value word,
+	// used by the generator to load and store operands straight from memory
+	struct Layout {
+		size_t type;
+		size_t lvalue;
+		size_t value;
+	};
+
+	static const Layout & layout();
+
 	template <typename T>
 	static RValue executeUnOp(const RValue &operand, Lua::UnOp::Type op)
 	{
@@ -37,12 +46,13 @@ public:
 	template <typename T>
 	void executeUnOp(Lua::UnOp::Type op)
 	{
-		if constexpr(std::is_arithmetic<T>::value) {
-			if (op == Lua::UnOp::Type::Negate)
-				m_value.second = -std::get<T>(m_value.second);
-		} else if constexpr(std::is_same<T, bool>::value) {
+		detach();
+		if constexpr(std::is_same<T, bool>::value) {
 			if (op == Lua::UnOp::Type::Not)
-				m_value.second = !std::get<T>(m_value.second);
+				m_value = Value{!value<T>()};
+		} else if constexpr(std::is_arithmetic<T>::value) {
+			if (op == Lua::UnOp::Type::Negate)
+				m_value = Value{static_cast<T>(-value<T>())};
 		} else {
 			std::cerr << "Unary operation " << Lua::UnOp::toString(op) << " not possible for type " << typeid(T).name() << '\n';
 			abort();
@@ -52,21 +62,23 @@ public:
 	template <typename T>
 	void executeBinOp(const RValue &operand, Lua::BinOp::Type op)
 	{
+		detach();
 		bool ok = true;
+		auto store = [this](auto v) { m_value = Value{static_cast<T>(v)}; };
 
 		if constexpr(std::is_arithmetic<T>::value) {
 			switch (op) {
 				case Lua::BinOp::Type::Plus:
-					m_value.second = std::get<T>(m_value.second) + operand.value<T>();
+					store(value<T>() + operand.value<T>());
 					break;
 				case Lua::BinOp::Type::Minus:
-					m_value.second = std::get<T>(m_value.second) - operand.value<T>();
+					store(value<T>() - operand.value<T>());
 					break;
 				case Lua::BinOp::Type::Times:
-					m_value.second = std::get<T>(m_value.second) * operand.value<T>();
+					store(value<T>() * operand.value<T>());
 					break;
 				case Lua::BinOp::Type::Divide:
-					m_value.second = std::get<T>(m_value.second) / operand.value<T>();
+					store(value<T>() / operand.value<T>());
 					break;
 				default:
 					ok = false;
@@ -74,14 +86,22 @@ public:
 			}
 		}
 
-		if constexpr(std::is_integral<T>::value) {
-			if (!ok && op == Lua::BinOp::Type::Modulo)
-				m_value.second = std::get<T>(m_value.second) % operand.value<T>();
+		if constexpr(std::is_same<T, int>::value) {
+			if (!ok && op == Lua::BinOp::Type::Modulo) {
+				store(value<T>() % operand.value<T>());
+				ok = true;
+			}
+		}
+
+		if constexpr(std::is_same<T, Atom>::value) {
+			ok = op == Lua::BinOp::Type::Concat;
+			if (ok)
+				store(value<T>() + operand.value<T>());
 		}
 
 		if constexpr(std::is_same<T, bool>::value) {
 			if (!ok && op == Lua::BinOp::Type::Plus)
-				m_value.second = std::get<T>(m_value.second) + operand.value<T>();
+				store(value<T>() + operand.value<T>());
 		}
 
 		if (!ok) {
@@ -90,14 +110,13 @@ public:
 		}
 	}
 
-	RValue() : m_type{Type::Immediate}, m_value{ValueType::Invalid, false} {}
-	explicit RValue(bool v) : m_type{Type::Immediate}, m_value{ValueType::Boolean, v} {}
-	RValue(int v) : m_type{Type::Immediate}, m_value{ValueType::Integer, v} {}
-	RValue(double v) : m_type{Type::Immediate}, m_value{ValueType::Real, v} {}
-	RValue(const std::string &v) : m_type{Type::Immediate}, m_value{ValueType::String, v} {}
-	RValue(std::string &&v) : m_type{Type::Immediate}, m_value{ValueType::String, std::move(v)} {}
-	RValue(fn_ptr v) : m_type{Type::Immediate}, m_value{ValueType::Function, v} {}
-	RValue(std::shared_ptr <Table> table) : m_type{Type::Immediate}, m_value{ValueType::Table, table} {}
+	RValue() : m_type{Type::Immediate} {}
+	explicit RValue(bool v) : m_type{Type::Immediate}, m_value{v} {}
+	RValue(int v) : m_type{Type::Immediate}, m_value{v} {}
+	RValue(double v) : m_type{Type::Immediate}, m_value{v} {}
+	RValue(Atom v) : m_type{Type::Immediate}, m_value{v} {}
+	RValue(const Builtin *v) : m_type{Type::Immediate}, m_value{v} {}
+	RValue(Table *table) : m_type{Type::Immediate}, m_value{table} {}
 
 	~RValue() = default;
 
@@ -106,7 +125,7 @@ public:
 		static const RValue NilValue = [] {
 			RValue result;
 			result.m_type = Type::Immediate;
-			result.m_value.first = ValueType::Nil;
+			result.m_value = Value::nil();
 			return result;
 		}();
 		return NilValue;
@@ -115,30 +134,41 @@ public:
 	Type type() const { return m_type; }
 	void setType(Type t) { m_type = t; }
 
-	bool isNil() const { return m_value.first == ValueType::Nil; }
-	void setNil() { m_type = Type::Immediate; m_value.first = ValueType::Nil; }
+	bool isNil() const { return value().isNil(); }
+	void setNil() { m_type = Type::Immediate; m_value = Value::nil(); }
 
-	ValueType valueType() const { return m_value.first; }
-	void setValueType(ValueType vt) { m_value.first = vt; }
+	ValueType valueType() const { return value().type(); }
 
 	template <typename T>
-	const T & value() const { return std::get<T>(m_value.second); }
+	T value() const { return value().get<T>(); }
 
-	const Value & value() const { return m_value; }
-	Value & value() { return m_value; }
+	// An lvalue only references its storage, reads always see the current value
+	const Value & value() const { return m_type == Type::LValue ? *m_lvalue : m_value; }
+	Value & value() { return m_type == Type::LValue ? *m_lvalue : m_value; }
 
 	template <typename T>
-	void setValue(const T &v) { m_type = Type::Temporary; m_value.second = v; }
+	void setValue(const T &v) { m_type = Type::Temporary; m_value = Value{v}; }
 	void setValue(const Value &v) { m_type = Type::Temporary; m_value = v; }
 
 	Value * lvalue() { return m_lvalue; }
-	void setLValue(Value *lvalue) { m_type = Type::LValue; m_lvalue = lvalue; m_value = *m_lvalue; }
+	void setLValue(Value *lvalue) { m_type = Type::LValue; m_lvalue = lvalue; }
 
 private:
+	// Results are computed in place, an lvalue first becomes a temporary holding its value
+	void detach()
+	{
+		if (m_type == Type::LValue)
+			setValue(*m_lvalue);
+	}
+
 	Type m_type;
 	Value *m_lvalue;
 	Value m_value;
 };
 
 void matchTypes(RValue &leftRValue, RValue &rightRValue);
+
+// Binary (de)serialization of compile-time RValues, used by the compile cache
+bool serialize(std::ostream &os, const RValue &rv);
+bool deserialize(std::istream &is, RValue &rv);
 std::ostream & operator << (std::ostream &os, const RValue &rv);
@@ -0,0 +1,140 @@
+#include <cassert>
+
+#include "Generator/AST.hpp"
+#include "Generator/Builtins.hpp"
+#include "Generator/Resolver.hpp"
+#include "Util/PrettyPrint.hpp"
+
+namespace Lua {
+
+Resolver::Resolver()
+{
+	m_scopes.emplace_back();
+	for (const Builtin &b : builtins())
+		m_scopes.back().emplace(Atom{b.name}, m_scopes.back().size());
+}
+
+void Resolver::resolve(const Node *root)
+{
+	visit(root);
+}
+
+void Resolver::resolveBatch(const Chunk *batch)
+{
+	// Nodes of the earlier batches are freed, their addresses may come back
+	m_slots.clear();
+	m_slotCounts.clear();
+
+	if (m_scopes.size() == 1)
+		m_scopes.emplace_back();
+	for (const auto &child : batch->children())
+		visit(child);
+	m_slotCounts[batch] = m_scopes.back().size();
+}
+
+Resolver::Slot Resolver::slot(const LValue *lval) const
+{
+	auto iter = m_slots.find(lval);
+	assert(iter != m_slots.end());
+	return iter->second;
+}
+
+size_t Resolver::slotCount(const Chunk *chunk) const
+{
+	auto iter = m_slotCounts.find(chunk);
+	assert(iter != m_slotCounts.end());
+	return iter->second;
+}
+
+Resolver::Slot Resolver::resolveName(Atom name)
+{
+	for (size_t i = m_scopes.size(); i > 0; --i) {
+		auto var = m_scopes[i - 1].find(name);
+		if (var != m_scopes[i - 1].end())
+			return {i - 1, var->second};
+	}
+
+	// Unknown names live in the innermost scope, same as an assignment would create them
+	auto &scope = m_scopes.back();
+	size_t index = scope.size();
+	scope.emplace(name, index);
+	return {m_scopes.size() - 1, index};
+}
+
+void Resolver::visit(const Node *n)
+{
+	switch (n->type()) {
+		case Node::Type::Chunk: {
+			const Chunk *c = static_cast<const Chunk *>(n);
+			m_scopes.emplace_back();
+			for (const auto &child : c->children())
+				visit(child);
+			m_slotCounts[c] = m_scopes.back().size();
+			m_scopes.pop_back();
+			break;
+		}
+		case Node::Type::ExprList:
+			for (const auto &expr : static_cast<const ExprList *>(n)->exprs())
+				visit(expr);
+			break;
+		case Node::Type::VarList:
+			for (const auto &var : static_cast<const VarList *>(n)->vars())
+				visit(var);
+			break;
+		case Node::Type::LValue: {
+			const LValue *lval = static_cast<const LValue *>(n);
+			switch (lval->lvalueType()) {
+				case LValue::Type::Bracket:
+					visit(lval->keyExpr());
+					visit(lval->tableExpr());
+					break;
+				case LValue::Type::Dot:
+					visit(lval->tableExpr());
+					break;
+				case LValue::Type::Name:
+					m_slots[lval] = resolveName(lval->name());
+					break;
+			}
+			break;
+		}
+		case Node::Type::FunctionCall: {
+			const FunctionCall *f = static_cast<const FunctionCall *>(n);
+			visit(f->functionExpr());
+			visit(f->args());
+			break;
+		}
+		case Node::Type::Assignment: {
+			const Assignment *a = static_cast<const Assignment *>(n);
+			visit(a->exprList());
+			visit(a->varList());
+			break;
+		}
+		case Node::Type::TableCtor:
+			for (const auto &field : static_cast<const TableCtor *>(n)->fields())
+				visit(field);
+			break;
+		case Node::Type::Field: {
+			const Field *f = static_cast<const Field *>(n);
+			if (f->fieldType() == Field::Type::Brackets)
+				visit(f->keyExpr());
+			visit(f->valueExpr());
+			break;
+		}
+		case Node::Type::BinOp: {
+			const BinOp *bo = static_cast<const BinOp *>(n);
+			visit(bo->left());
+			visit(bo->right());
+			break;
+		}
+		case Node::Type::UnOp:
+			visit(static_cast<const UnOp *>(n)->operand());
+			break;
+		case Node::Type::Value:
+			break;
+		default:
+			std::cerr << "Resolver: unsupported node type " << prettyPrint(n->type()) << '\n';
+			abort();
+	}
+}
+
+} //namespace Lua
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "Generator/Atom.hpp"
+
+namespace Lua {
+
+class Chunk;
+class LValue;
+class Node;
+
+/*
+ * Maps every variable name to a fixed (scope depth, slot index) pair
+ * before code generation, so the runtime never looks names up.
+ * Depth 0 is the builtin scope set up by initRuntime().
+ */
+class Resolver {
+public:
+	struct Slot {
+		size_t depth;
+		size_t index;
+	};
+
+	Resolver();
+
+	void resolve(const Node *root);
+	// Streaming mode: batches of one chunk share its scope, names keep the slots earlier batches gave them
+	void resolveBatch(const Chunk *batch);
+
+	Slot slot(const LValue *lval) const;
+	size_t slotCount(const Chunk *chunk) const;
+
+private:
+	void visit(const Node *n);
+	Slot resolveName(Atom name);
+
+	std::vector <std::unordered_map <Atom, size_t> > m_scopes;
+	std::unordered_map <const LValue *, Slot> m_slots;
+	std::unordered_map <const Chunk *, size_t> m_slotCounts;
+};
+
+} //namespace Lua
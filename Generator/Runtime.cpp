@@ -1,235 +1,255 @@
 #include <cassert>
+#include <deque>
 #include <iostream>
 #include <vector>
 
 #include "Generator/AST.hpp"
 #include "Generator/Builtins.hpp"
+#include "Generator/Collector.hpp"
 #include "Generator/Program.hpp"
 #include "Generator/RValue.hpp"
 #include "Generator/Runtime.hpp"
 #include "Generator/Scope.hpp"
 #include "Generator/Table.hpp"
-#include "Util/Casts.hpp"
 #include "Util/PrettyPrint.hpp"
 
 namespace {
 
-std::vector <Scope> scopeStack;
-std::vector <void *> dataStack;
+std::deque <Scope> scopeStack;
+// Temporaries of the chunks being executed, see Program::allocTemporary()
+std::deque <std::vector <RValue> > frameStack;
+// Inline caches of the generated code, they outlive the frames so hits carry over between calls
+std::vector <InlineCache> inlineCaches;
 
-template <typename T>
-T popData()
+Table * indexedTable(const RValue *table)
 {
-	assert(!dataStack.empty());
-	void *p = dataStack.back();
-	dataStack.pop_back();
-	if constexpr(std::is_integral<T>::value)
-		return fromVoidPtr<T>(p);
-	else
-		return static_cast<T>(p);
+	if (table->valueType() != ValueType::Table) {
+		std::cerr << "Attempted to index non-table type\n";
+		abort();
+	}
+
+	return table->value<Table *>();
 }
 
-std::pair <Scope *, Variable *> __findScope(const std::string *varName)
+} //namespace
+
+void initRuntime(Program &)
 {
-	for (size_t i = scopeStack.size(); i > 0; --i) {
-		Scope *scope = &scopeStack[i - 1];
-		auto var = scope->getVariable(varName);
-		if (var)
-			return std::make_pair(scope, var);
+	Scope &s = scopeStack.emplace_back();
+
+	for (const Builtin &b : builtins()) {
+		RValue tmp{&b};
+		s.addVariable(Atom{b.name}, &tmp);
 	}
+}
 
-	return {nullptr, nullptr};
+// The next batch numbers its cache sites from 0 again, the cells must not hit for them
+void releaseBatch()
+{
+	inlineCaches.clear();
+	Collector::instance().releasePinned();
 }
 
-void initVariable()
+void rt_scope_push(size_t slotCount)
 {
-	const std::string *varName = popData<std::string *>();
-	scopeStack.back().setVariable(varName, &RValue::Nil());
+	scopeStack.emplace_back(slotCount);
 }
 
-void executeAssign()
+void rt_scope_pop()
 {
-	RValue *dst = popData<RValue *>();
-	const RValue *src = popData<RValue *>();
+	scopeStack.pop_back();
+}
 
-#ifndef NDEBUG
-	std::cout << "Assign value: " << *src << '\n';
-#endif
+// Later batches of a streamed chunk add their variables to the scope the first one pushed
+void rt_scope_grow(size_t slotCount)
+{
+	scopeStack.back().grow(slotCount);
+}
 
+void rt_assign(RValue *dst, const RValue *src)
+{
 	assert(dst->type() == RValue::Type::LValue);
 	*dst->lvalue() = src->value();
 }
 
-void executeUnOp(Lua::UnOp::Type op)
+void rt_unop(int op, RValue *dst, const RValue *src)
 {
-	RValue *dst = popData<RValue *>();
-	const RValue *src = popData<RValue *>();
+	Lua::UnOp::Type unOp = static_cast<Lua::UnOp::Type>(op);
 	dst->setValue(src->value());
 
 	switch (dst->valueType()) {
 		case ValueType::Boolean:
-			dst->executeUnOp<bool>(op);
+			dst->executeUnOp<bool>(unOp);
 			break;
 		case ValueType::Integer:
-			dst->executeUnOp<int>(op);
+			dst->executeUnOp<int>(unOp);
 			break;
 		case ValueType::Real:
-			dst->executeUnOp<double>(op);
+			dst->executeUnOp<double>(unOp);
 			break;
 		default:
-			std::cerr << "Unary operation " << Lua::UnOp::toString(op) << " not possible for type " << prettyPrint(dst->valueType()) << '\n';
+			std::cerr << "Unary operation " << Lua::UnOp::toString(unOp) << " not possible for type " << prettyPrint(dst->valueType()) << '\n';
 			break;
 	}
 }
 
-void executeBinOp(Lua::BinOp::Type op)
+void rt_binop(int op, RValue *dst, const RValue *left, const RValue *right)
 {
-	RValue *dst = popData<RValue *>();
-	RValue *left = popData<RValue *>();
-	RValue *right = popData<RValue *>();
+	Lua::BinOp::Type binOp = static_cast<Lua::BinOp::Type>(op);
 
-	matchTypes(*left, *right);
-	dst->setValue(left->value());
+	// matchTypes() promotes operands in place, work on copies so constants stay intact
+	RValue l{*left};
+	RValue r{*right};
+	matchTypes(l, r);
+	dst->setValue(l.value());
 
-	switch (left->valueType()) {
+	switch (l.valueType()) {
 		case ValueType::Boolean:
-			dst->executeBinOp<bool>(*right, op);
+			dst->executeBinOp<bool>(r, binOp);
 			break;
 		case ValueType::Integer:
-			dst->executeBinOp<int>(*right, op);
+			dst->executeBinOp<int>(r, binOp);
 			break;
 		case ValueType::Real:
-			dst->executeBinOp<double>(*right, op);
+			dst->executeBinOp<double>(r, binOp);
 			break;
 		case ValueType::String:
-			dst->executeBinOp<std::string>(*right, op);
+			// Built by the running code, such strings are collected once unreachable
+			if (binOp == Lua::BinOp::Type::Concat && r.valueType() == ValueType::String) {
+				dst->setValue(Atom::runtime(l.value<Atom>().str() + r.value<Atom>().str()));
+				break;
+			}
+			dst->executeBinOp<Atom>(r, binOp);
 			break;
 		default:
-			std::cerr << "Binary operation " << Lua::BinOp::toString(op) << " not possible for type " << prettyPrint(left->valueType()) << '\n';
+			std::cerr << "Binary operation " << Lua::BinOp::toString(binOp) << " not possible for type " << prettyPrint(l.valueType()) << '\n';
 			abort();
 	}
 }
 
-void executeFunctionCall()
+void rt_function_call(RValue *dst, const RValue *fn, size_t argCnt, RValue * const *args)
 {
-	const RValue *rval_fn = popData<RValue *>();
-
-	size_t argCnt = popData<size_t>();
-	__arg_vec args(argCnt);
-	for (size_t i = 0; i != argCnt; ++i)
-		args[i] = popData<RValue *>();
-
-	if (rval_fn->valueType() != ValueType::Function) {
-		std::cerr << "Attempted to call value of type " << prettyPrint(rval_fn->valueType()) << '\n';
+	if (fn->valueType() != ValueType::Function) {
+		std::cerr << "Attempted to call value of type " << prettyPrint(fn->valueType()) << '\n';
 		abort();
 	}
 
-	RValue *result = popData<RValue *>();
-	auto func = rval_fn->value<fn_ptr>();
-	func(&args, result);
+	const Builtin *f = fn->value<const Builtin *>();
+	if (f->arity == Builtin::Variadic || static_cast<size_t>(f->arity) == argCnt) {
+		f->function(dst, args, argCnt);
+		return;
+	}
+
+	// Adjust the arguments to the arity the way Lua does, still without touching the heap
+	assert(f->arity <= Builtin::MaxArity);
+	const RValue *adjusted[Builtin::MaxArity];
+	for (size_t i = 0; i != static_cast<size_t>(f->arity); ++i)
+		adjusted[i] = i < argCnt ? args[i] : &RValue::Nil();
+	f->function(dst, adjusted, f->arity);
+}
+
+void rt_resolve_slot(RValue *dst, size_t depth, size_t slot)
+{
+	assert(depth < scopeStack.size() && slot < scopeStack[depth].size());
+	dst->setLValue(scopeStack[depth].variable(slot)->asLValue());
 }
 
-void resolveName()
+// arraySize of the fields are positional, the table is allocated with room for all of them
+void rt_table_ctor(RValue *dst, size_t arraySize, size_t fieldCnt, RValue * const *fields)
 {
-	const std::string *varName = popData<const std::string *>();
-	RValue *dst = popData<RValue *>();
+	Table *table = Table::create(arraySize, fieldCnt - arraySize);
 
-	Variable *var = __findScope(varName).second;
-	if (var == nullptr)
-		var = scopeStack.back().setVariable(varName, &RValue::Nil());
+	for (size_t i = 0; i != fieldCnt; ++i)
+		table->setValue(*fields[2 * i], *fields[2 * i + 1]);
 
-	dst->setLValue(var->asLValue());
+	dst->setValue(table);
 }
 
-void constructTable()
+// Every key is already in the shape, setting the fields only overwrites values
+void rt_table_clone(RValue *dst, const RValue *shape, size_t fieldCnt, RValue * const *fields)
 {
-	size_t fieldCnt = popData<size_t>();
+	Table *table = Table::create(*shape->value<Table *>());
 
-	std::shared_ptr <Table> table = std::make_shared<Table>();
+	for (size_t i = 0; i != fieldCnt; ++i)
+		table->setValue(*fields[2 * i], *fields[2 * i + 1]);
 
-	while (fieldCnt != 0) {
-		--fieldCnt;
-		RValue *key = popData<RValue *>();
-		RValue *value = popData<RValue *>();
-		table->setValue(*key, *value);
-	}
+	dst->setValue(table);
+}
 
-	RValue *result = popData<RValue *>();
-	result->setValue(table);
-	result->setValueType(ValueType::Table);
+// Reads leave the table alone, a missing key reads as Nil
+void rt_table_get(RValue *dst, const RValue *table, const RValue *key)
+{
+	const Value *value = indexedTable(table)->get(*key);
+	dst->setValue(value != nullptr ? *value : Value::nil());
 }
 
-void accessTable()
+// Slow path of a cached read site: a plain lookup that also refills the cache
+void rt_table_get_cached(RValue *dst, const RValue *table, const RValue *key, InlineCache *cache)
 {
-	const RValue *tableValue = popData<RValue *>();
-	const RValue *keyValue = popData<RValue *>();
+	rt_table_get(dst, table, key);
+	table->value<Table *>()->fillCache(key->value(), *cache);
+}
 
-	if (tableValue->valueType() != ValueType::Table) {
-		std::cerr << "Attempted to index non-table type\n";
-		abort();
-	}
+// Assignment targets, the key is added to the table if it is missing
+void rt_table_lvalue(RValue *dst, const RValue *table, const RValue *key)
+{
+	Table *t = indexedTable(table);
+	if (t->needsBarrier())
+		rt_gc_barrier(t);
+	dst->setLValue(t->getOrInsert(*key));
+}
 
-	RValue *result = popData<RValue *>();
-	result->setLValue(tableValue->value<std::shared_ptr <Table> >()->value(*keyValue));
+void rt_table_lvalue_cached(RValue *dst, const RValue *table, const RValue *key, InlineCache *cache)
+{
+	rt_table_lvalue(dst, table, key);
+	table->value<Table *>()->fillCache(key->value(), *cache);
 }
 
-} //namespace
+RValue * rt_frame_enter(size_t slotCount)
+{
+	return frameStack.emplace_back(slotCount).data();
+}
 
-void initRuntime(Program &program)
+InlineCache * rt_inline_caches(size_t count)
 {
-	Scope s;
+	if (inlineCaches.size() < count)
+		inlineCaches.resize(count, InlineCache{nullptr, 0, 0});
+	return inlineCaches.data();
+}
 
-#define export(funcName) \
-	{ \
-		std::string *name = program.duplicateString(#funcName); \
-		RValue tmp{&funcName}; \
-		s.setVariable(name, &tmp); \
-	} \
+const Builtin * rt_builtins()
+{
+	return builtins().data();
+}
 
-	export(__ping);
-	export(print);
-#undef export
+void rt_frame_leave()
+{
+	frameStack.pop_back();
+}
 
-	scopeStack.push_back(s);
+/*
+ * Called between statements, when every live value is held by a variable or
+ * a frame temporary. Lvalue temporaries are skipped: they point into
+ * variables or table slots and are never used past the statement that made them.
+ */
+void rt_gc_safepoint()
+{
+	Collector::instance().safepoint([](const Collector::Marker &mark) {
+		for (Scope &scope : scopeStack) {
+			for (size_t i = 0; i != scope.size(); ++i)
+				mark(scope.variable(i)->value());
+		}
+
+		for (const std::vector <RValue> &frame : frameStack) {
+			for (const RValue &rv : frame) {
+				if (rv.type() != RValue::Type::LValue)
+					mark(rv.value());
+			}
+		}
+	});
 }
 
-void runcall(RuncallNum call, void *arg)
+void rt_gc_barrier(Table *table)
 {
-	switch (call) {
-		case RUNCALL_SCOPE_PUSH:
-			scopeStack.push_back(Scope{});
-			break;
-		case RUNCALL_SCOPE_POP:
-			scopeStack.pop_back();
-			break;
-		case RUNCALL_PUSH:
-			dataStack.push_back(arg);
-			break;
-		case RUNCALL_INIT_VARIABLE:
-			initVariable();
-			break;
-		case RUNCALL_RESOLVE_NAME:
-			resolveName();
-			break;
-		case RUNCALL_ASSIGN:
-			executeAssign();
-			break;
-		case RUNCALL_UNOP:
-			executeUnOp(fromVoidPtr<Lua::UnOp::Type>(arg));
-			break;
-		case RUNCALL_BINOP:
-			executeBinOp(fromVoidPtr<Lua::BinOp::Type>(arg));
-			break;
-		case RUNCALL_FUNCTION_CALL:
-			executeFunctionCall();
-			break;
-		case RUNCALL_TABLE_CTOR:
-			constructTable();
-			break;
-		case RUNCALL_TABLE_ACCESS:
-			accessTable();
-			break;
-		default:
-			std::cout << "Runcall " << call << " not supported\n";
-	}
+	Collector::instance().barrier(table);
 }
@@ -1,22 +1,42 @@
 #pragma once
 
-typedef int RuncallNum;
-
-enum __runcall_operation : RuncallNum {
-	RUNCALL_SCOPE_PUSH,
-	RUNCALL_SCOPE_POP,
-	RUNCALL_PUSH,
-	RUNCALL_INIT_VARIABLE,
-	RUNCALL_RESOLVE_NAME,
-	RUNCALL_ASSIGN,
-	RUNCALL_UNOP,
-	RUNCALL_BINOP,
-	RUNCALL_FUNCTION_CALL,
-	RUNCALL_TABLE_CTOR,
-	RUNCALL_TABLE_ACCESS,
-};
+#include <cstddef>
 
 class Program;
+class RValue;
+class Table;
+struct Builtin;
+struct InlineCache;
 
 void initRuntime(Program &program);
-void runcall(RuncallNum call, void *arg);
+// Streaming mode: drops what the runtime kept for a batch that has run
+void releaseBatch();
+
+/*
+ * Runtime entry points called directly by the generated code,
+ * imported into the JIT context by Program::prepareRuntime()
+ */
+extern "C" {
+
+void rt_scope_push(size_t slotCount);
+void rt_scope_pop();
+void rt_scope_grow(size_t slotCount);
+void rt_resolve_slot(RValue *dst, size_t depth, size_t slot);
+void rt_assign(RValue *dst, const RValue *src);
+void rt_unop(int op, RValue *dst, const RValue *src);
+void rt_binop(int op, RValue *dst, const RValue *left, const RValue *right);
+void rt_function_call(RValue *dst, const RValue *fn, size_t argCnt, RValue * const *args);
+void rt_table_ctor(RValue *dst, size_t arraySize, size_t fieldCnt, RValue * const *fields);
+void rt_table_clone(RValue *dst, const RValue *shape, size_t fieldCnt, RValue * const *fields);
+void rt_table_get(RValue *dst, const RValue *table, const RValue *key);
+void rt_table_get_cached(RValue *dst, const RValue *table, const RValue *key, InlineCache *cache);
+void rt_table_lvalue(RValue *dst, const RValue *table, const RValue *key);
+void rt_table_lvalue_cached(RValue *dst, const RValue *table, const RValue *key, InlineCache *cache);
+RValue * rt_frame_enter(size_t slotCount);
+InlineCache * rt_inline_caches(size_t count);
+const Builtin * rt_builtins();
+void rt_frame_leave();
+void rt_gc_safepoint();
+void rt_gc_barrier(Table *table);
+
+}
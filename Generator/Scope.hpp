@@ -1,19 +1,25 @@
 #pragma once
 
-#include <unordered_map>
+#include <deque>
 
 #include "Generator/RValue.hpp"
 #include "Generator/ValueType.hpp"
 #include "Generator/Variable.hpp"
 
+/*
+ * Variables are addressed by the slot index assigned by Lua::Resolver.
+ * std::deque keeps their addresses stable, the generated code holds
+ * pointers to them.
+ */
 class Scope {
 public:
-	Variable * getVariable(const std::string *varName);
-	Variable * setVariable(const std::string *varName, const RValue *value);
-	Variable * setVariable(const std::string *varName, const Variable *value);
-	bool removeVariable(const std::string *varName);
-	bool removeVariable(const Variable *var);
+	explicit Scope(size_t slotCount = 0) : m_vars(slotCount) {}
+
+	Variable * variable(size_t slot) { return &m_vars[slot]; }
+	Variable * addVariable(Atom varName, const RValue *value);
+	void grow(size_t slotCount) { if (m_vars.size() < slotCount) m_vars.resize(slotCount); }
+	size_t size() const { return m_vars.size(); }
 
 private:
-	std::unordered_map <std::string, Variable> m_vars; //TODO change std::string to string_view?
+	std::deque <Variable> m_vars;
 };
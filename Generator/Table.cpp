@@ -1,21 +1,127 @@
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#include "Generator/Collector.hpp"
 #include "Generator/Table.hpp"
-#include "Util/Fold.hpp"
 
-Value * Table::value(const RValue &key)
+const Shape * Shape::root()
+{
+	static const Shape root{0};
+	return &root;
+}
+
+const Shape * Shape::dictionary()
+{
+	static const Shape dictionary{MaxKeys};
+	return &dictionary;
+}
+
+const Shape * Shape::child(const Value &key) const
+{
+	// Dot sites only ever look up literal strings, other keys would just grow the tree.
+	// Transitions are never freed, so neither may their keys be
+	if (this == dictionary() || m_size + 1 >= MaxKeys || key.type() != ValueType::String || key.get<Atom>().collectable())
+		return dictionary();
+
+	std::unique_ptr <Shape> &result = m_transitions[key];
+	if (!result)
+		result.reset(new Shape{m_size + 1});
+	return result.get();
+}
+
+const Table::Layout & Table::layout()
+{
+	static const Layout result = []{
+		const Table base;
+		auto offset = [&base](const void *member) -> size_t {
+			return static_cast<const char *>(member) - reinterpret_cast<const char *>(&base);
+		};
+
+		Layout layout;
+		layout.shape = offset(&base.m_shape);
+		layout.hashSegments = offset(&base.m_hashValues.m_segments);
+		layout.barrier = offset(&base.m_barrier);
+		return layout;
+	}();
+
+	return result;
+}
+
+Table::Table(const Table &other)
+	: m_array{other.m_array}, m_arrayCount{other.m_arrayCount},
+	m_shape{other.m_shape}, m_hashValues{other.m_hashValues}, m_hashCount{other.m_hashCount}, m_hashIntegers{other.m_hashIntegers},
+	m_nodes{other.m_nodes}
+{
+	// The index still points into the values of other
+	for (Node &node : m_nodes) {
+		if (node.value != nullptr)
+			node.value = m_hashValues.at(other.m_hashValues.indexOf(node.value));
+	}
+}
+
+Table * Table::create(size_t arraySize, size_t hashSize)
+{
+	Table *table = new Table;
+	table->reserve(arraySize, hashSize);
+	Collector::instance().track(table);
+	return table;
+}
+
+Table * Table::create(const Table &shape)
+{
+	Table *table = new Table{shape};
+	Collector::instance().track(table);
+	return table;
+}
+
+Table * Table::createPinned(size_t arraySize, size_t hashSize)
+{
+	Table *table = new Table;
+	table->reserve(arraySize, hashSize);
+	Collector::instance().pin(table);
+	return table;
+}
+
+// Allocates everything up front, so filling in that many keys never grows the table
+void Table::reserve(size_t arraySize, size_t hashSize)
+{
+	while (m_array.capacity() < arraySize)
+		m_array.grow(Value{});
+
+	while (m_hashValues.capacity() < hashSize)
+		m_hashValues.grow(Value{});
+
+	size_t nodes = m_nodes.empty() ? 4 : m_nodes.size();
+	while (4 * hashSize > 3 * nodes)
+		nodes *= 2;
+	if (hashSize > 0 && nodes != m_nodes.size())
+		rehash(nodes);
+}
+
+const Value * Table::get(const RValue &key) const
+{
+	// Nil is never a key, reading it is just a miss
+	if (key.isNil())
+		return nullptr;
+
+	return find(key.value());
+}
+
+Value * Table::getOrInsert(const RValue &key)
 {
 	checkKey(key);
 
-	auto iter = m_data.find(key.value().second);
-	if (iter == m_data.end())
-		return setValue(key, RValue::Nil());
-	return &iter->second;
+	return findOrInsert(key.value());
 }
 
 Value * Table::setValue(const RValue &key, const RValue &value)
 {
 	checkKey(key);
 
-	return &m_data.insert_or_assign(key.value().second, value.value()).first->second;
+	Value *slot = findOrInsert(key.value());
+	*slot = value.value();
+	return slot;
 }
 
 void Table::checkKey(const RValue &key) const
@@ -26,16 +132,241 @@ void Table::checkKey(const RValue &key) const
 	}
 }
 
+Table::Segments::Segments(const Segments &other)
+{
+	for (size_t i = 0; i != other.m_count; ++i) {
+		grow(Value{});
+		std::copy(other.m_segments[i], other.m_segments[i] + segmentSize(i), m_segments[i]);
+	}
+}
+
+Table::Segments::~Segments()
+{
+	for (size_t i = 0; i != m_count; ++i)
+		delete[] m_segments[i];
+	delete[] m_segments;
+}
+
+void Table::Segments::locate(size_t index, size_t &segment, size_t &offset)
+{
+	if (index < FirstSegmentSize) {
+		segment = 0;
+		offset = index;
+		return;
+	}
+
+	// Segment n > 0 starts at FirstSegmentSize << (n - 1) and is as long as everything before it
+	segment = 64 - __builtin_clzll(index / FirstSegmentSize);
+	offset = index - (FirstSegmentSize << (segment - 1));
+}
+
+Value * Table::Segments::at(size_t index)
+{
+	size_t segment, offset;
+	locate(index, segment, offset);
+	return &m_segments[segment][offset];
+}
+
+size_t Table::Segments::indexOf(const Value *value) const
+{
+	std::less <const Value *> less;
+	size_t base = 0;
+	for (size_t i = 0; i != m_count; ++i) {
+		const Value *begin = m_segments[i];
+		size_t size = segmentSize(i);
+		if (!less(value, begin) && less(value, begin + size))
+			return base + (value - begin);
+		base += size;
+	}
+
+	assert(false);
+	return base;
+}
+
+size_t Table::Segments::capacity() const
+{
+	return m_count == 0 ? 0 : FirstSegmentSize << (m_count - 1);
+}
+
+void Table::Segments::grow(const Value &fill)
+{
+	// The segment index doubles whenever the count reaches a power of two
+	if ((m_count & (m_count - 1)) == 0) {
+		Value **segments = new Value *[m_count == 0 ? 1 : 2 * m_count];
+		std::copy(m_segments, m_segments + m_count, segments);
+		delete[] m_segments;
+		m_segments = segments;
+	}
+
+	size_t size = segmentSize(m_count);
+	m_segments[m_count] = new Value[size];
+	std::fill(m_segments[m_count], m_segments[m_count] + size, fill);
+	++m_count;
+}
+
+Value * Table::find(const Value &key)
+{
+	if (key.type() == ValueType::Integer) {
+		int index = key.get<int>();
+		if (index > 0 && static_cast<size_t>(index) <= m_array.capacity()) {
+			Value *slot = m_array.at(index - 1);
+			if (slot->type() != ValueType::Invalid)
+				return slot;
+			if (m_hashIntegers == 0)
+				return nullptr;
+		}
+	}
+
+	return findHash(key);
+}
+
+Value * Table::findOrInsert(const Value &key)
+{
+	if (Value *slot = find(key))
+		return slot;
+
+	if (Value *slot = arraySlot(key)) {
+		*slot = Value::nil();
+		++m_arrayCount;
+		return slot;
+	}
+
+	return insertHash(key);
+}
+
+/*
+ * Free array slot for a new integer key, growing the array part by a
+ * segment when the key falls into the next one and the array is at least
+ * half full, so sparse keys don't allocate long runs of empty slots.
+ */
+Value * Table::arraySlot(const Value &key)
+{
+	if (key.type() != ValueType::Integer || key.get<int>() <= 0)
+		return nullptr;
+
+	size_t index = key.get<int>() - 1;
+	size_t capacity = m_array.capacity();
+	if (index >= capacity) {
+		size_t grown = capacity == 0 ? 4 : 2 * capacity;
+		if (index >= grown || 2 * m_arrayCount < capacity)
+			return nullptr;
+		m_array.grow(Value{});
+	}
+
+	return m_array.at(index);
+}
+
+Value * Table::findHash(const Value &key)
+{
+	if (m_nodes.empty())
+		return nullptr;
+
+	size_t mask = m_nodes.size() - 1;
+	for (size_t i = std::hash<Value>{}(key) & mask; m_nodes[i].value != nullptr; i = (i + 1) & mask) {
+		if (m_nodes[i].key == key)
+			return m_nodes[i].value;
+	}
+
+	return nullptr;
+}
+
+Value * Table::insertHash(const Value &key)
+{
+	// Keep the load factor at most 3/4, probe sequences stay short
+	if (4 * (m_hashCount + 1) > 3 * m_nodes.size())
+		rehash(m_nodes.empty() ? 4 : 2 * m_nodes.size());
+
+	if (m_hashCount == m_hashValues.capacity())
+		m_hashValues.grow(Value{});
+
+	Value *value = m_hashValues.at(m_hashCount++);
+	*value = Value::nil();
+	m_shape = m_shape->child(key);
+	if (key.type() == ValueType::Integer)
+		++m_hashIntegers;
+
+	size_t mask = m_nodes.size() - 1;
+	size_t i = std::hash<Value>{}(key) & mask;
+	while (m_nodes[i].value != nullptr)
+		i = (i + 1) & mask;
+	m_nodes[i] = {key, value};
+
+	return value;
+}
+
+void Table::fillCache(const Value &key, InlineCache &cache) const
+{
+	if (m_shape == Shape::dictionary())
+		return;
+
+	Value *value = const_cast<Table *>(this)->findHash(key);
+	if (value == nullptr)
+		return;
+
+	cache.shape = m_shape;
+	Segments::locate(m_hashValues.indexOf(value), cache.segment, cache.offset);
+}
+
+// Only the index is rebuilt, the values stay where they are
+void Table::rehash(size_t size)
+{
+	std::vector <Node> nodes(size, Node{Value{}, nullptr});
+	size_t mask = size - 1;
+
+	for (const Node &node : m_nodes) {
+		if (node.value == nullptr)
+			continue;
+		size_t i = std::hash<Value>{}(node.key) & mask;
+		while (nodes[i].value != nullptr)
+			i = (i + 1) & mask;
+		nodes[i] = node;
+	}
+
+	m_nodes = std::move(nodes);
+}
+
 std::ostream & operator << (std::ostream &os, const Table &t)
 {
 	bool first = true;
 	os << '{';
-	for (const auto &p : t.m_data) {
+	t.forEach([&](const Value &key, const Value &value) {
 		if (!first)
 			os << ", ";
 		first = false;
-		os << "{Key: " << p.first << ", " << p.second << '}';
-	}
+		os << "{Key: " << key << ", " << value << '}';
+	});
 	os << '}';
 	return os;
 }
+
+bool serialize(std::ostream &os, const Table &t)
+{
+	uint64_t size = t.m_arrayCount + t.m_hashCount;
+	os.write(reinterpret_cast<const char *>(&size), sizeof(size));
+
+	bool ok = true;
+	t.forEach([&](const Value &k, const Value &v) {
+		RValue key, value;
+		key.setValue(k);
+		value.setValue(v);
+		ok = ok && serialize(os, key) && serialize(os, value);
+	});
+
+	return ok && os.good();
+}
+
+bool deserialize(std::istream &is, Table &t)
+{
+	uint64_t size;
+	if (!is.read(reinterpret_cast<char *>(&size), sizeof(size)))
+		return false;
+
+	for (uint64_t i = 0; i != size; ++i) {
+		RValue key, value;
+		if (!deserialize(is, key) || !deserialize(is, value))
+			return false;
+		t.setValue(key, value);
+	}
+
+	return true;
+}
@@ -1,20 +1,171 @@
 #pragma once
 
 #include <cassert>
+#include <functional>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "Generator/RValue.hpp"
 #include "Generator/Value.hpp"
 
+/*
+ * Hidden class of a table: the sequence of keys added to its hash part.
+ * Tables that got the same keys in the same order share a shape, and the
+ * n-th key of a shape lives in the n-th hash value slot of every such table.
+ * Shapes are never freed: tables with many keys or with a key that is not a
+ * string drop to the dictionary shape.
+ */
+class Shape {
+public:
+	static const Shape * root();
+	static const Shape * dictionary();
+
+	const Shape * child(const Value &key) const;
+
+private:
+	static constexpr size_t MaxKeys = 32;
+
+	explicit Shape(size_t size) : m_size{size} {}
+
+	size_t m_size;
+	mutable std::unordered_map <Value, std::unique_ptr <Shape> > m_transitions;
+};
+
+// Per access site cache of where a key was found, see Table::fillCache()
+struct InlineCache {
+	const Shape *shape;
+	size_t segment;
+	size_t offset;
+};
+
+/*
+ * Lua style hybrid table: positive integer keys up to the array capacity
+ * live in the array part, everything else in an open addressing hash part.
+ * The runtime hands out Value pointers as lvalues, so values never move:
+ * both parts keep them in segments that are only ever added, growing and
+ * rehashing just adds segments and rebuilds the hash index.
+ */
 class Table {
 	friend std::ostream & operator << (std::ostream &os, const Table &t);
+	friend bool serialize(std::ostream &os, const Table &t);
+	friend bool deserialize(std::istream &is, Table &t);
+	friend class Collector;
 public:
-	Value * value(const RValue &key);
+	// Byte offsets of the shape, the hash segment index and the write barrier flag, for the generated inline cache checks
+	struct Layout {
+		size_t shape;
+		size_t hashSegments;
+		size_t barrier;
+	};
+
+	static const Layout & layout();
+
+	Table() = default;
+	Table(const Table &other);
+	Table & operator = (const Table &) = delete;
+
+	// Tables are owned by the Collector and freed once unreachable
+	static Table * create(size_t arraySize = 0, size_t hashSize = 0);
+	// Copies the keys and values of a shape prebuilt at compile time in one go
+	static Table * create(const Table &shape);
+	// Tables built while compiling are referenced by the generated code, they are never freed
+	static Table * createPinned(size_t arraySize = 0, size_t hashSize = 0);
+
+	void reserve(size_t arraySize, size_t hashSize);
+
+	// Reads never add keys, nullptr if key is absent
+	const Value * get(const RValue &key) const;
+	// Assignment targets, absent keys are added with a Nil value
+	Value * getOrInsert(const RValue &key);
 	Value * setValue(const RValue &key, const RValue &value);
 
+	// Writes into the table have to be reported to Collector::barrier() first
+	bool needsBarrier() const { return m_barrier; }
+
+	// Points cache at the hash value slot of key, unless the table is in dictionary mode
+	void fillCache(const Value &key, InlineCache &cache) const;
+
 private:
+	// Values in segments of doubling size, indices map to a segment in O(1)
+	class Segments {
+		friend class Table;
+	public:
+		Segments() = default;
+		Segments(const Segments &other);
+		~Segments();
+		Segments & operator = (const Segments &) = delete;
+
+		Value * at(size_t index);
+		const Value * at(size_t index) const { return const_cast<Segments *>(this)->at(index); }
+		size_t indexOf(const Value *value) const;
+		size_t capacity() const;
+		void grow(const Value &fill);
+
+	private:
+		static constexpr size_t FirstSegmentSize = 4;
+
+		static size_t segmentSize(size_t segment) { return segment == 0 ? FirstSegmentSize : FirstSegmentSize << (segment - 1); }
+		static void locate(size_t index, size_t &segment, size_t &offset);
+
+		// Plain arrays, the generated code indexes m_segments directly
+		Value **m_segments = nullptr;
+		size_t m_count = 0;
+	};
+
+	// Hash index entry, an empty slot has no value
+	struct Node {
+		Value key;
+		Value *value;
+	};
+
 	void checkKey(const RValue &key) const;
 
-	std::map <ValueVariant, Value> m_data;
+	Value * find(const Value &key);
+	const Value * find(const Value &key) const { return const_cast<Table *>(this)->find(key); }
+	Value * findOrInsert(const Value &key);
+	Value * arraySlot(const Value &key);
+	Value * findHash(const Value &key);
+	Value * insertHash(const Value &key);
+	void rehash(size_t size);
+
+	template <typename F>
+	void forEach(F f) const;
+
+	// Absent array entries hold an Invalid value
+	Segments m_array;
+	size_t m_arrayCount = 0;
+
+	const Shape *m_shape = Shape::root();
+	Segments m_hashValues;
+	size_t m_hashCount = 0;
+	// Integer keys in the hash that fall into the array range are looked up there as well
+	size_t m_hashIntegers = 0;
+	std::vector <Node> m_nodes;
+
+	// Collector state, see Collector.hpp
+	bool m_barrier = false;
+	bool m_marked = false;
+	bool m_old = false;
+	bool m_remembered = false;
 };
+
+template <typename F>
+void Table::forEach(F f) const
+{
+	for (size_t i = 0; i != m_array.capacity(); ++i) {
+		const Value *value = m_array.at(i);
+		if (value->type() != ValueType::Invalid)
+			f(Value{static_cast<int>(i + 1)}, *value);
+	}
+
+	for (const Node &node : m_nodes) {
+		if (node.value != nullptr)
+			f(node.key, *node.value);
+	}
+}
+
+// Used for tables prebuilt at compile time, see RValue serialization
+bool serialize(std::ostream &os, const Table &t);
+bool deserialize(std::istream &is, Table &t);
@@ -0,0 +1,176 @@
+#include "Generator/AST.hpp"
+#include "Generator/Builtins.hpp"
+#include "Generator/TypeInference.hpp"
+
+namespace Lua {
+
+namespace {
+
+TypeSet unOpTypes(UnOp::Type op, TypeSet operand)
+{
+	if (op == UnOp::Type::Negate && operand.subsetOf(TypeSet::numbers()))
+		return operand;
+	return TypeSet::any();
+}
+
+TypeSet binOpTypes(BinOp::Type op, TypeSet left, TypeSet right)
+{
+	switch (op) {
+		case BinOp::Type::Plus:
+		case BinOp::Type::Minus:
+		case BinOp::Type::Times:
+		case BinOp::Type::Divide: {
+			if (!left.subsetOf(TypeSet::numbers()) || !right.subsetOf(TypeSet::numbers()))
+				break;
+
+			// Mixed operands are promoted to Real, see matchTypes()
+			TypeSet result;
+			if (left.contains(ValueType::Integer) && right.contains(ValueType::Integer))
+				result = result | ValueType::Integer;
+			if (left.contains(ValueType::Real) || right.contains(ValueType::Real))
+				result = result | ValueType::Real;
+			return result;
+		}
+
+		case BinOp::Type::Modulo:
+			if (left == ValueType::Integer && right == ValueType::Integer)
+				return ValueType::Integer;
+			break;
+
+		case BinOp::Type::Concat:
+			if (left == ValueType::String && right == ValueType::String)
+				return ValueType::String;
+			break;
+
+		default:
+			break;
+	}
+
+	// Anything else either goes through the generic runtime path or fails there
+	return TypeSet::any();
+}
+
+} //namespace
+
+TypeInference::TypeInference()
+{
+	for (const Builtin &b : builtins())
+		m_variables.emplace(Atom{b.name}, ValueType::Function);
+}
+
+void TypeInference::infer(const Node *root)
+{
+	// Streaming mode infers batch after batch, the variables carry over but earlier nodes are freed
+	m_types.clear();
+	statement(root);
+}
+
+TypeSet TypeInference::types(const Node *expr) const
+{
+	auto iter = m_types.find(expr);
+	if (iter == m_types.end())
+		return TypeSet::any();
+	return iter->second;
+}
+
+void TypeInference::statement(const Node *n)
+{
+	switch (n->type()) {
+		case Node::Type::Chunk:
+			for (const auto &child : static_cast<const Chunk *>(n)->children())
+				statement(child);
+			break;
+
+		case Node::Type::Assignment: {
+			const Assignment *a = static_cast<const Assignment *>(n);
+			const auto &exprs = a->exprList()->exprs();
+			for (const auto &expr : exprs)
+				expression(expr);
+
+			// Targets are stored in order, an index expression sees the stores before it
+			size_t i = 0;
+			for (const auto &lval : a->varList()->vars()) {
+				TypeSet stored = i < exprs.size() ? types(exprs[i]) : TypeSet{ValueType::Nil};
+				if (lval->lvalueType() == LValue::Type::Name) {
+					m_variables[lval->name()] = stored;
+				} else {
+					if (lval->lvalueType() == LValue::Type::Bracket)
+						expression(lval->keyExpr());
+					expression(lval->tableExpr());
+				}
+				m_types[lval] = stored;
+				++i;
+			}
+			break;
+		}
+
+		default:
+			expression(n);
+			break;
+	}
+}
+
+TypeSet TypeInference::expression(const Node *n)
+{
+	TypeSet result = TypeSet::any();
+
+	switch (n->type()) {
+		case Node::Type::Value:
+			result = static_cast<const Value *>(n)->valueType();
+			break;
+
+		case Node::Type::LValue: {
+			const LValue *lval = static_cast<const LValue *>(n);
+			if (lval->lvalueType() == LValue::Type::Name) {
+				auto iter = m_variables.find(lval->name());
+				result = iter != m_variables.end() ? iter->second : TypeSet{ValueType::Nil};
+				break;
+			}
+
+			// Table contents are not tracked
+			if (lval->lvalueType() == LValue::Type::Bracket)
+				expression(lval->keyExpr());
+			expression(lval->tableExpr());
+			break;
+		}
+
+		case Node::Type::FunctionCall: {
+			const FunctionCall *f = static_cast<const FunctionCall *>(n);
+			expression(f->functionExpr());
+			for (const auto &arg : f->args()->exprs())
+				expression(arg);
+			break;
+		}
+
+		case Node::Type::TableCtor:
+			for (const auto &field : static_cast<const TableCtor *>(n)->fields()) {
+				if (field->fieldType() == Field::Type::Brackets)
+					expression(field->keyExpr());
+				expression(field->valueExpr());
+			}
+			result = ValueType::Table;
+			break;
+
+		case Node::Type::UnOp: {
+			const UnOp *uo = static_cast<const UnOp *>(n);
+			result = unOpTypes(uo->unOpType(), expression(uo->operand()));
+			break;
+		}
+
+		case Node::Type::BinOp: {
+			const BinOp *bo = static_cast<const BinOp *>(n);
+			TypeSet left = expression(bo->left());
+			TypeSet right = expression(bo->right());
+			result = binOpTypes(bo->binOpType(), left, right);
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	m_types[n] = result;
+	return result;
+}
+
+} //namespace Lua
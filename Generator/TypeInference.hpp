@@ -0,0 +1,36 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "Generator/Atom.hpp"
+#include "Generator/TypeSet.hpp"
+
+namespace Lua {
+
+class Node;
+
+/*
+ * Flow-sensitive type inference over a chunk. Statements run in order and
+ * exactly once, so the types a global may hold are tracked per statement
+ * and every expression gets the set of ValueTypes it may evaluate to.
+ */
+class TypeInference {
+public:
+	TypeInference();
+
+	// Either the whole chunk or its batches in order
+	void infer(const Node *root);
+
+	// Types an expression may evaluate to, any() for nodes never inferred
+	TypeSet types(const Node *expr) const;
+
+private:
+	void statement(const Node *n);
+	TypeSet expression(const Node *n);
+
+	std::unordered_map <const Node *, TypeSet> m_types;
+	// Types of globals at the current statement, unassigned names are nil
+	std::unordered_map <Atom, TypeSet> m_variables;
+};
+
+} //namespace Lua
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Generator/ValueType.hpp"
+#include "Util/EnumHelpers.hpp"
+
+// Set of ValueTypes an expression may evaluate to
+class TypeSet {
+public:
+	constexpr TypeSet() : m_bits{0} {}
+	constexpr TypeSet(ValueType vt) : m_bits{bit(vt)} {}
+
+	// Nothing known, includes Invalid for results builtins never set
+	static constexpr TypeSet any() { return TypeSet{(1u << toUnderlying(ValueType::_last)) - 1}; }
+	static constexpr TypeSet numbers() { return TypeSet{ValueType::Integer} | ValueType::Real; }
+
+	constexpr bool contains(ValueType vt) const { return m_bits & bit(vt); }
+	constexpr bool subsetOf(TypeSet other) const { return (m_bits & ~other.m_bits) == 0; }
+	constexpr bool empty() const { return m_bits == 0; }
+	constexpr bool single() const { return m_bits != 0 && (m_bits & (m_bits - 1)) == 0; }
+
+	// The only possible type, Unknown unless single()
+	ValueType only() const
+	{
+		if (!single())
+			return ValueType::Unknown;
+		return static_cast<ValueType>(__builtin_ctz(m_bits));
+	}
+
+	constexpr TypeSet operator | (TypeSet other) const { return TypeSet{m_bits | other.m_bits}; }
+	constexpr TypeSet operator & (TypeSet other) const { return TypeSet{m_bits & other.m_bits}; }
+	constexpr bool operator == (TypeSet other) const { return m_bits == other.m_bits; }
+	constexpr bool operator != (TypeSet other) const { return m_bits != other.m_bits; }
+
+private:
+	constexpr explicit TypeSet(unsigned int bits) : m_bits{bits} {}
+
+	static constexpr unsigned int bit(ValueType vt) { return 1u << toUnderlying(vt); }
+
+	unsigned int m_bits;
+};
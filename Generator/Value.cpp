@@ -6,25 +6,25 @@
 
 std::ostream & operator << (std::ostream &os, const Value &v)
 {
-	os << "Value: {type = " << prettyPrint(v.first) << ", value = ";
-	switch (v.first) {
+	os << "Value: {type = " << prettyPrint(v.type()) << ", value = ";
+	switch (v.type()) {
 		case ValueType::Boolean:
-			os << std::boolalpha << std::get<bool>(v.second);
+			os << std::boolalpha << v.get<bool>();
 			break;
 		case ValueType::Integer:
-			os << std::get<int>(v.second);
+			os << v.get<int>();
 			break;
 		case ValueType::Real:
-			os << std::get<double>(v.second);
+			os << v.get<double>();
 			break;
 		case ValueType::String:
-			os << std::get<std::string>(v.second);
+			os << v.get<Atom>();
 			break;
 		case ValueType::Function:
-			os << std::get<fn_ptr>(v.second);
+			os << static_cast<const void *>(v.get<const Builtin *>());
 			break;
 		case ValueType::Table:
-			os << *std::get<std::shared_ptr <Table> >(v.second);
+			os << *v.get<Table *>();
 			break;
 		default:
 			os << "<unknown>";
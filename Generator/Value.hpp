@@ -1,8 +1,139 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iosfwd>
+
+#include "Generator/Atom.hpp"
 #include "Generator/ValueType.hpp"
-#include "Generator/ValueVariant.hpp"
 
-typedef std::pair <ValueType, ValueVariant> Value;
+class RValue;
+class Table;
+struct Builtin;
+
+// Native calling convention: the result and a contiguous span of arguments, see Builtin
+typedef void (*fn_ptr)(RValue *result, const RValue * const *args, size_t argCnt);
+
+/*
+ * NaN-boxed value, a single trivially copyable 64-bit word.
+ * Reals are stored as their IEEE bits. Everything else is encoded above
+ * the negative quiet NaNs: the top 16 bits hold 0xfff8 + tag and the low
+ * 48 bits hold the payload (int, bool, Atom entry, Table or Builtin pointer).
+ * NaNs are canonicalized on the way in so that no real can look boxed.
+ */
+class Value {
+public:
+	// Every word at or above this is boxed, the generated code compares against it
+	static constexpr uint64_t FirstBoxed = 0xfff9000000000000ull;
+	static constexpr unsigned TagShift = 48;
+	static constexpr uint64_t PayloadMask = (1ull << TagShift) - 1;
+
+	Value() : m_bits{box(ValueType::Invalid, 0)} {}
+	explicit Value(bool v) : m_bits{box(ValueType::Boolean, v)} {}
+	explicit Value(int v) : m_bits{box(ValueType::Integer, static_cast<uint32_t>(v))} {}
+	explicit Value(double v) : m_bits{fromReal(v)} {}
+	explicit Value(Atom v) : m_bits{box(ValueType::String, reinterpret_cast<uintptr_t>(v.handle()))} {}
+	explicit Value(const Builtin *v) : m_bits{box(ValueType::Function, reinterpret_cast<uintptr_t>(v))} {}
+	explicit Value(Table *v) : m_bits{box(ValueType::Table, reinterpret_cast<uintptr_t>(v))} {}
+
+	static Value nil()
+	{
+		Value result;
+		result.m_bits = box(ValueType::Nil, 0);
+		return result;
+	}
+
+	ValueType type() const { return m_bits < FirstBoxed ? ValueType::Real : tagType(m_bits >> TagShift); }
+	bool isNil() const { return m_bits == box(ValueType::Nil, 0); }
+
+	template <typename T>
+	T get() const;
+
+	uint64_t bits() const { return m_bits; }
+	// The word the generated code compares (bits >> TagShift) with to test for a type
+	static constexpr uint64_t tagWord(ValueType vt) { return box(vt, 0) >> TagShift; }
+
+	bool operator == (const Value &other) const { return m_bits == other.m_bits; }
+	bool operator != (const Value &other) const { return m_bits != other.m_bits; }
+
+private:
+	static constexpr uint64_t tag(ValueType vt)
+	{
+		switch (vt) {
+			case ValueType::Invalid: return 1;
+			case ValueType::Nil: return 2;
+			case ValueType::Boolean: return 3;
+			case ValueType::Integer: return 4;
+			case ValueType::String: return 5;
+			case ValueType::Table: return 6;
+			case ValueType::Function: return 7;
+			default: return 0;
+		}
+	}
+
+	static ValueType tagType(uint64_t word)
+	{
+		static constexpr ValueType Types[] = {ValueType::Real, ValueType::Invalid, ValueType::Nil, ValueType::Boolean,
+			ValueType::Integer, ValueType::String, ValueType::Table, ValueType::Function};
+		return Types[word - 0xfff8];
+	}
+
+	static constexpr uint64_t box(ValueType vt, uint64_t payload)
+	{
+		return ((0xfff8 + tag(vt)) << TagShift) | (payload & PayloadMask);
+	}
+
+	static uint64_t fromReal(double v)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		return bits >= FirstBoxed ? 0x7ff8000000000000ull : bits;
+	}
+
+	uint64_t payload() const { return m_bits & PayloadMask; }
+
+	uint64_t m_bits;
+};
+
+template <>
+inline bool Value::get <bool> () const { return payload() != 0; }
+
+template <>
+inline int Value::get <int> () const { return static_cast<int>(static_cast<uint32_t>(m_bits)); }
+
+template <>
+inline double Value::get <double> () const
+{
+	double result;
+	std::memcpy(&result, &m_bits, sizeof(result));
+	return result;
+}
+
+template <>
+inline Atom Value::get <Atom> () const { return Atom::fromHandle(reinterpret_cast<const void *>(payload())); }
+
+template <>
+inline const Builtin * Value::get <const Builtin *> () const { return reinterpret_cast<const Builtin *>(payload()); }
+
+template <>
+inline Table * Value::get <Table *> () const { return reinterpret_cast<Table *>(payload()); }
 
 std::ostream & operator << (std::ostream &os, const Value &v);
+
+namespace std {
+
+template <>
+struct hash <Value> {
+	size_t operator () (const Value &v) const
+	{
+		// Strings hash by content, boxed pointers alone would cluster
+		if (v.type() == ValueType::String)
+			return v.get<Atom>().hash();
+		uint64_t h = v.bits() * 0x9e3779b97f4a7c15ull;
+		return h ^ (h >> 32);
+	}
+};
+
+} //namespace std
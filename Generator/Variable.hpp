@@ -6,11 +6,12 @@
 
 class Variable {
 public:
-	const char *& name() { return m_name; }
-	const char * name() const { return m_name; }
+	Variable() : m_value{Value::nil()} {}
 
-	ValueType & type() { return m_value.first; }
-	const ValueType & type() const { return m_value.first; }
+	Atom & name() { return m_name; }
+	Atom name() const { return m_name; }
+
+	ValueType type() const { return m_value.type(); }
 
 	Value & value() { return m_value; }
 	const Value & value() const { return m_value; }
@@ -18,7 +19,7 @@ public:
 	Value * asLValue() { return &m_value; }
 
 private:
-	const char *m_name;
+	Atom m_name;
 	Value m_value;
 };
 
@@ -1,4 +1,5 @@
 %{
+#include <functional>
 #include <iostream>
 
 #include "Generator/AST.hpp"
@@ -14,15 +15,48 @@ Lua::Node *root;
 
 int yydebug = 1;
 
+namespace {
+
+// Streaming mode, see parseInBatches()
+size_t batchSize = 0;
+std::function <void (Lua::Chunk *)> batchHandler;
+
+// A full batch is handed over and its tree freed, the statements after it start a new chunk
+Lua::Chunk * batchParsed(Lua::Chunk *chunk)
+{
+	if (batchSize == 0 || chunk->children().size() < batchSize)
+		return chunk;
+
+	batchHandler(chunk);
+	Lua::astArena().clear();
+	return Lua::make<Lua::Chunk>();
+}
+
+} //namespace
+
 %}
 
 %define parse.error verbose
 
+%code requires {
+#include <cstddef>
+#include <string_view>
+
+// Token text, viewing the source buffer
+struct TokenText {
+	const char *data;
+	size_t size;
+
+	std::string_view view() const { return {data, size}; }
+};
+}
+
 %union {
 	int int_value;
-	char *str;
+	TokenText text;
 	double real_value;
 	Lua::Node *node;
+	Lua::Chunk *chunk;
 	Lua::ExprList *expr_list;
 	Lua::VarList *var_list;
 	Lua::LValue *var;
@@ -31,7 +65,8 @@ int yydebug = 1;
 	Lua::Field *field;
 }
 
-%type <node> chunk expr prefix_expr statement
+%type <chunk> chunk
+%type <node> expr prefix_expr statement
 %type <expr_list> args expr_list
 %type <func_call> func_call
 %type <var_list> var_list
@@ -41,7 +76,7 @@ int yydebug = 1;
 
 %token <int_value> INT_VALUE
 %token <real_value> REAL_VALUE
-%token <str> ID STRING_VALUE
+%token <text> ID STRING_VALUE
 %token BREAK RETURN NIL TRUE FALSE
 %token LENGTH NOT
 %token END_OF_INPUT 0 "eof"
@@ -65,18 +100,20 @@ chunk {
 
 chunk :
 statement {
-	$$ = new Lua::Chunk{};
+	$$ = Lua::make<Lua::Chunk>();
 	$$->append($1);
+	$$ = batchParsed($$);
 }
 | chunk statement {
 	$$ = $1;
 	$$->append($2);
+	$$ = batchParsed($$);
 }
 ;
 
 statement :
 var_list ASSIGN expr_list {
-	$$ = new Lua::Assignment{$1, $3};
+	$$ = Lua::make<Lua::Assignment>($1, $3);
 }
 | func_call {
 	$$ = $1;
@@ -85,7 +122,7 @@ var_list ASSIGN expr_list {
 
 expr_list :
 expr {
-	$$ = new Lua::ExprList{};
+	$$ = Lua::make<Lua::ExprList>();
 	$$->append($1);
 }
 | expr_list COMMA expr {
@@ -95,7 +132,7 @@ expr {
 
 var_list :
 var {
-	$$ = new Lua::VarList{};
+	$$ = Lua::make<Lua::VarList>();
 	$$->append($1);
 }
 | var_list COMMA var {
@@ -105,14 +142,13 @@ var {
 
 var :
 ID {
-	$$ = new Lua::LValue{$1};
-	free($1);
+	$$ = Lua::make<Lua::LValue>(Atom{$1.view()});
 }
 | prefix_expr '[' expr ']' {
-	$$ = new Lua::LValue{$1, $3};
+	$$ = Lua::make<Lua::LValue>($1, $3);
 }
 | prefix_expr '.' ID {
-	$$ = new Lua::LValue{$1, $3};
+	$$ = Lua::make<Lua::LValue>($1, Atom{$3.view()});
 }
 
 prefix_expr :
@@ -129,7 +165,7 @@ var {
 
 func_call :
 prefix_expr args {
-	$$ = new Lua::FunctionCall{$1, $2};
+	$$ = Lua::make<Lua::FunctionCall>($1, $2);
 }
 
 args :
@@ -137,45 +173,48 @@ args :
 	$$ = $2;
 }
 | '(' ')' {
-	$$ = new Lua::ExprList{};
+	$$ = Lua::make<Lua::ExprList>();
 }
 
 expr :
 NIL {
-	$$ = new Lua::NilValue{};
+	$$ = Lua::make<Lua::NilValue>();
 }
 | FALSE {
-	$$ = new Lua::BooleanValue{false};
+	$$ = Lua::make<Lua::BooleanValue>(false);
 }
 | TRUE {
-	$$ = new Lua::BooleanValue{true};
+	$$ = Lua::make<Lua::BooleanValue>(true);
 }
 | INT_VALUE {
-	$$ = new Lua::IntValue{$1};
+	$$ = Lua::make<Lua::IntValue>($1);
 }
 | REAL_VALUE {
-	$$ = new Lua::RealValue{$1};
+	$$ = Lua::make<Lua::RealValue>($1);
 }
 | STRING_VALUE {
-	$$ = new Lua::StringValue{$1};
+	$$ = Lua::make<Lua::StringValue>(Atom{$1.view()});
+}
+| expr CONCAT expr {
+	$$ = Lua::make<Lua::BinOp>(Lua::BinOp::Type::Concat, $1, $3);
 }
 | expr PLUS expr {
-	$$ = new Lua::BinOp{Lua::BinOp::Type::Plus, $1, $3};
+	$$ = Lua::make<Lua::BinOp>(Lua::BinOp::Type::Plus, $1, $3);
 }
 | expr MINUS expr {
-	$$ = new Lua::BinOp{Lua::BinOp::Type::Minus, $1, $3};
+	$$ = Lua::make<Lua::BinOp>(Lua::BinOp::Type::Minus, $1, $3);
 }
 | expr TIMES expr {
-	$$ = new Lua::BinOp{Lua::BinOp::Type::Times, $1, $3};
+	$$ = Lua::make<Lua::BinOp>(Lua::BinOp::Type::Times, $1, $3);
 }
 | expr DIV expr {
-	$$ = new Lua::BinOp{Lua::BinOp::Type::Divide, $1, $3};
+	$$ = Lua::make<Lua::BinOp>(Lua::BinOp::Type::Divide, $1, $3);
 }
 | expr MOD expr {
-	$$ = new Lua::BinOp{Lua::BinOp::Type::Modulo, $1, $3};
+	$$ = Lua::make<Lua::BinOp>(Lua::BinOp::Type::Modulo, $1, $3);
 }
 | MINUS expr %prec NEGATE {
-	$$ = new Lua::UnOp{Lua::UnOp::Type::Negate, $2};
+	$$ = Lua::make<Lua::UnOp>(Lua::UnOp::Type::Negate, $2);
 }
 | table_ctor {
 	$$ = $1;
@@ -187,7 +226,7 @@ NIL {
 
 table_ctor :
 '{' '}' {
-	$$ = new Lua::TableCtor{};
+	$$ = Lua::make<Lua::TableCtor>();
 }
 | '{' field_list '}' {
 	$$ = $2;
@@ -195,7 +234,7 @@ table_ctor :
 
 field_list :
 field {
-	$$ = new Lua::TableCtor{};
+	$$ = Lua::make<Lua::TableCtor>();
 	$$->append($1);
 }
 | field_list COMMA field {
@@ -205,13 +244,34 @@ field {
 
 field :
 '[' expr ']' ASSIGN expr {
-	$$ = new Lua::Field{$2, $5};
+	$$ = Lua::make<Lua::Field>($2, $5);
 }
 | ID ASSIGN expr {
-	$$ = new Lua::Field{$1, $3};
+	$$ = Lua::make<Lua::Field>(Atom{$1.view()}, $3);
 }
 | expr {
-	$$ = new Lua::Field{$1};
+	$$ = Lua::make<Lua::Field>($1);
 }
 
 %%
+
+/*
+ * Streaming mode: the handler gets the chunk in batches of the given number
+ * of statements as soon as they are parsed, the last one may be shorter. A
+ * chunk is only ever reduced with nothing but tokens on the parser stack, so
+ * each batch can be freed before parsing goes on.
+ */
+int parseInBatches(size_t statements, std::function <void (Lua::Chunk *)> handler)
+{
+	batchSize = statements;
+	batchHandler = std::move(handler);
+
+	int result = yyparse();
+	Lua::Chunk *last = static_cast<Lua::Chunk *>(root);
+	if (result == 0 && !last->children().empty())
+		batchHandler(last);
+
+	batchSize = 0;
+	batchHandler = nullptr;
+	return result;
+}
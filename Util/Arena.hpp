@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Bump allocator for objects of a single type. Objects are placed one after
+ * another in blocks that never move, so their addresses stay stable, and
+ * are all destroyed at once by clear() or the destructor.
+ */
+template <typename T>
+class Arena {
+public:
+	Arena() = default;
+	~Arena() { clear(); }
+
+	Arena(const Arena &) = delete;
+	Arena & operator = (const Arena &) = delete;
+
+	template <typename... Args>
+	T * create(Args &&... args)
+	{
+		if (m_blocks.empty() || m_blocks.back().used == m_blocks.back().capacity)
+			grow();
+
+		Block &block = m_blocks.back();
+		T *result = new (&block.storage[block.used]) T(std::forward<Args>(args)...);
+		++block.used;
+		++m_size;
+		return result;
+	}
+
+	size_t size() const { return m_size; }
+
+	// Position of an object in creation order, size() if it's not from this arena
+	size_t indexOf(const T *object) const
+	{
+		std::less <const void *> less;
+		size_t base = 0;
+		for (const Block &block : m_blocks) {
+			const Slot *begin = block.storage.get();
+			if (!less(object, begin) && less(object, begin + block.used))
+				return base + (reinterpret_cast<const Slot *>(object) - begin);
+			base += block.used;
+		}
+		return m_size;
+	}
+
+	void clear()
+	{
+		for (Block &block : m_blocks) {
+			for (size_t i = 0; i != block.used; ++i)
+				std::launder(reinterpret_cast<T *>(&block.storage[i]))->~T();
+		}
+
+		m_blocks.clear();
+		m_size = 0;
+	}
+
+private:
+	struct alignas(T) Slot {
+		std::byte bytes[sizeof(T)];
+	};
+
+	struct Block {
+		std::unique_ptr <Slot[]> storage;
+		size_t capacity;
+		size_t used;
+	};
+
+	static constexpr size_t FirstBlockSize = 64;
+	static constexpr size_t MaxBlockSize = 64 * 1024;
+
+	void grow()
+	{
+		// Blocks double in size, large scripts end up with few big blocks
+		size_t capacity = m_blocks.empty() ? FirstBlockSize : std::min(m_blocks.back().capacity * 2, MaxBlockSize);
+		m_blocks.push_back({std::unique_ptr <Slot[]>{new Slot[capacity]}, capacity, 0});
+	}
+
+	std::vector <Block> m_blocks;
+	size_t m_size = 0;
+};
+
+/*
+ * Bump allocator for objects of mixed types. Destructors of objects that
+ * need one are recorded and run, in reverse order, by clear().
+ */
+class MonotonicArena {
+public:
+	MonotonicArena() = default;
+	~MonotonicArena() { clear(); }
+
+	MonotonicArena(const MonotonicArena &) = delete;
+	MonotonicArena & operator = (const MonotonicArena &) = delete;
+
+	template <typename T, typename... Args>
+	T * create(Args &&... args)
+	{
+		T *result = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if constexpr(!std::is_trivially_destructible<T>::value)
+			m_destructors.push_back({result, [](void *object) { static_cast<T *>(object)->~T(); }});
+		return result;
+	}
+
+	// Uninitialized storage for count objects
+	template <typename T>
+	T * allocateArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "array elements are never destroyed");
+		return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	void clear()
+	{
+		for (auto iter = m_destructors.rbegin(); iter != m_destructors.rend(); ++iter)
+			iter->second(iter->first);
+
+		m_destructors.clear();
+		m_blocks.clear();
+		m_current = m_end = nullptr;
+		m_nextBlockSize = FirstBlockSize;
+	}
+
+private:
+	static constexpr size_t FirstBlockSize = 4096;
+	static constexpr size_t MaxBlockSize = 1024 * 1024;
+
+	void * allocate(size_t size, size_t alignment)
+	{
+		size_t padding = m_current ? -reinterpret_cast<uintptr_t>(m_current) & (alignment - 1) : 0;
+		if (m_current == nullptr || static_cast<size_t>(m_end - m_current) < padding + size) {
+			size_t blockSize = std::max(m_nextBlockSize, size + alignment);
+			m_blocks.emplace_back(new std::byte[blockSize]);
+			m_current = m_blocks.back().get();
+			m_end = m_current + blockSize;
+			m_nextBlockSize = std::min(m_nextBlockSize * 2, MaxBlockSize);
+			padding = -reinterpret_cast<uintptr_t>(m_current) & (alignment - 1);
+		}
+
+		void *result = m_current + padding;
+		m_current += padding + size;
+		return result;
+	}
+
+	std::vector <std::unique_ptr <std::byte[]> > m_blocks;
+	std::byte *m_current = nullptr;
+	std::byte *m_end = nullptr;
+	size_t m_nextBlockSize = FirstBlockSize;
+	std::vector <std::pair <void *, void (*)(void *)> > m_destructors;
+};
@@ -0,0 +1,89 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Util/SourceBuffer.hpp"
+
+SourceBuffer::SourceBuffer(const char *path)
+{
+	int fd = STDIN_FILENO;
+	if (path) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			std::cerr << "Unable to open " << path << ": " << strerror(errno) << '\n';
+			exit(1);
+		}
+	}
+
+	if (!map(fd))
+		read(fd);
+
+	if (path)
+		close(fd);
+}
+
+SourceBuffer::~SourceBuffer()
+{
+	if (m_mapped)
+		munmap(m_data, m_mapped);
+	else
+		free(m_data);
+}
+
+bool SourceBuffer::map(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+
+	size_t size = st.st_size;
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t length = (size + 2 + pageSize - 1) / pageSize * pageSize;
+
+	// Zeroed pages first, the file goes over them: the terminators come from
+	// the zeroed tail of the last file page or from the page after it
+	void *base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return false;
+	if (size != 0 && mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, length);
+		return false;
+	}
+	madvise(base, length, MADV_SEQUENTIAL);
+
+	m_data = static_cast<char *>(base);
+	m_size = size;
+	m_mapped = length;
+	return true;
+}
+
+void SourceBuffer::read(int fd)
+{
+	size_t capacity = 64 * 1024;
+	m_data = static_cast<char *>(malloc(capacity));
+
+	for (;;) {
+		if (m_size + 2 == capacity) {
+			capacity *= 2;
+			m_data = static_cast<char *>(realloc(m_data, capacity));
+		}
+
+		ssize_t n = ::read(fd, m_data + m_size, capacity - m_size - 2);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			std::cerr << "Unable to read the script: " << strerror(errno) << '\n';
+			exit(1);
+		}
+		if (n == 0)
+			break;
+		m_size += n;
+	}
+
+	m_data[m_size] = m_data[m_size + 1] = '\0';
+}
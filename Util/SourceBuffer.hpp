@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+/*
+ * The script being run. A regular file, stdin redirected from one included,
+ * is mapped into memory rather than read, so scanning it costs no copies;
+ * pipes and terminals are read into a heap buffer instead.
+ *
+ * The text is followed by the two NUL bytes yy_scan_buffer() expects, the
+ * scanner works on it in place and tokens are views into it, so it has to
+ * outlive the parse.
+ */
+class SourceBuffer {
+public:
+	// Reads stdin when path is null
+	explicit SourceBuffer(const char *path);
+	~SourceBuffer();
+
+	SourceBuffer(const SourceBuffer &) = delete;
+	SourceBuffer & operator = (const SourceBuffer &) = delete;
+
+	std::string_view text() const { return {m_data, m_size}; }
+
+	// The text and its terminators, writable as flex needs them
+	char * scannerData() { return m_data; }
+	size_t scannerSize() const { return m_size + 2; }
+
+private:
+	bool map(int fd);
+	void read(int fd);
+
+	char *m_data = nullptr;
+	size_t m_size = 0;
+	// Length of the mapping, 0 when the text is on the heap
+	size_t m_mapped = 0;
+};
@@ -1,25 +1,207 @@
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "Generator/AST.hpp"
 extern Lua::Node *root;
+void scanSource(char *data, size_t size);
+int parseInBatches(size_t statements, std::function <void (Lua::Chunk *)> handler);
 
+#include "Generator/CompileCache.hpp"
 #include "Generator/Generator.hpp"
+#include "Generator/Interpreter.hpp"
+#include "Generator/Optimizer.hpp"
 #include "Generator/Program.hpp"
 #include "Generator/Runtime.hpp"
-#include "Util/Casts.hpp"
 #include "Parser.hpp"
+#include "Util/SourceBuffer.hpp"
+
+namespace {
+
+struct Options {
+	int optimizationLevel = 0;
+	bool tiered = false;
+	unsigned tierUp = 0;
+	size_t batchSize = 0;
+};
 
-int main()
+void usage(const char *argv0)
 {
-	yyparse();
-	root->print();
-	Lua::generate(root);
-	auto result = Program::getInstance().compile();
+	std::cerr << "Usage: " << argv0 << " [options] [script.lua]\n"
+		<< "  reads the script from stdin when no file is given\n"
+		<< "  -O<level>          GCC optimization level (default 0, 3 with --tiered)\n"
+		<< "  --tiered           run an unoptimized build at once, compile the -O<level> one into the cache in the background\n"
+		<< "  --tier-up=<runs>   interpret the first <runs> runs of a script, compile (and cache) it afterwards\n"
+		<< "  --batch=<n>        stream the script: parse, compile and run it <n> statements at a time,\n"
+		<< "                     without the compile cache, tiers or GIMPLE dumps\n";
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+	static const option LongOptions[] = {
+		{"tiered", no_argument, nullptr, 't'},
+		{"tier-up", required_argument, nullptr, 'u'},
+		{"batch", required_argument, nullptr, 'b'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	Options options;
+	std::optional <int> optimizationLevel;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "O::h", LongOptions, nullptr)) != -1) {
+		switch (opt) {
+			case 'O':
+				optimizationLevel = optarg ? atoi(optarg) : 1;
+				break;
+			case 't':
+				options.tiered = true;
+				break;
+			case 'u':
+				options.tierUp = atoi(optarg);
+				break;
+			case 'b':
+				options.batchSize = strtoull(optarg, nullptr, 10);
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	options.optimizationLevel = optimizationLevel.value_or(options.tiered ? 3 : 0);
+	return options;
+}
+
+void compileError(Program &program)
+{
+	const char *error = gcc_jit_context_get_first_error(program.context());
+	std::cerr << "Compilation failed: " << (error ? error : "unknown error") << '\n';
+}
+
+/*
+ * The optimized build of a tiered run only pays off in later runs, through
+ * the compile cache. A grandchild process builds it into the cache while this
+ * one goes on with the quick build, and nobody waits for it.
+ */
+void storeInBackground(const Program &program, const CompileCache &cache, const std::string &rvalues)
+{
+	// The children must not repeat what is still buffered
+	std::cout.flush();
+
+	// GCC waits for the assembler and linker it starts, so SIGCHLD keeps its default: the
+	// intermediate child exits at once and is reaped here, init reaps the orphaned worker
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (fork() == 0)
+			cache.store(program, rvalues);
+		_exit(0);
+	}
+	if (pid < 0)
+		std::cerr << "Unable to start the background compile: " << strerror(errno) << '\n';
+	else
+		waitpid(pid, nullptr, 0);
+}
+
+/*
+ * Every batch of statements is optimized, generated, compiled and run in
+ * a JIT context of its own before the next one is parsed, so the tree, the
+ * generator state and GCC's IR only ever hold a single batch.
+ */
+int runInBatches(SourceBuffer &source, size_t batchSize)
+{
+	Program &program = Program::getInstance();
+	program.setDumpGimple(false);
+	initRuntime(program);
+
+	scanSource(source.scannerData(), source.scannerSize());
+	return parseInBatches(batchSize, [&program](Lua::Chunk *batch) {
+		Lua::optimizeBatch(batch);
+		Lua::generateBatch(batch);
+
+		gcc_jit_result *result = program.compile();
+		if (result == nullptr) {
+			compileError(program);
+			exit(1);
+		}
+		reinterpret_cast<Program::EntryPoint>(gcc_jit_result_get_code(result, "__main"))(program.rvalues());
+
+		gcc_jit_result_release(result);
+		releaseBatch();
+		program.nextBatch();
+	});
+}
+
+} //namespace
+
+int main(int argc, char *argv[])
+{
+	Options options = parseOptions(argc, argv);
+	if (argc - optind > 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	SourceBuffer source{optind < argc ? argv[optind] : nullptr};
+
+	if (options.batchSize > 0)
+		return runInBatches(source, options.batchSize);
+
+	Program &program = Program::getInstance();
+	program.setOptimizationLevel(options.optimizationLevel);
+	program.setDumpGimple(!options.tiered);
+	CompileCache cache{source.text(), program.optionsKey()};
+
+	// Runs are counted in the cache, without it every run would be the first one
+	if (options.tierUp > 0 && !cache.enabled()) {
+		std::cerr << "--tier-up needs the compile cache, ignored\n";
+		options.tierUp = 0;
+	}
+
+	Program::EntryPoint entryPoint = cache.load(program);
+	if (entryPoint == nullptr) {
+		scanSource(source.scannerData(), source.scannerSize());
+		yyparse();
+		Lua::optimize(root);
+
+		// Scripts run once don't pay for GCC, only the ones that keep coming back get compiled
+		if (options.tierUp > 0 && cache.countRun() <= options.tierUp) {
+			initRuntime(program);
+			Lua::interpret(root);
+			return 0;
+		}
+
+		Lua::generate(root);
+
+		// Everything needed from here on lives in the JIT context and the RValue table
+		Lua::astArena().clear();
+		root = nullptr;
+
+		std::string rvalues = cache.enabled() ? CompileCache::snapshot(program) : std::string{};
+		if (options.tiered) {
+			if (cache.enabled())
+				storeInBackground(program, cache, rvalues);
+			program.setOptimizationLevel(0);
+			entryPoint = program.compileEntryPoint();
+		} else {
+			entryPoint = cache.store(program, rvalues);
+			if (entryPoint == nullptr)
+				entryPoint = program.compileEntryPoint();
+		}
 
-	void *fn_ptr = gcc_jit_result_get_code(result, "__main");
+		if (entryPoint == nullptr) {
+			compileError(program);
+			return 1;
+		}
+	}
 
-	typedef void (*RuntimePtr)(int, void *);
-	auto entryPoint = function_cast<void (RuntimePtr)>(fn_ptr);
-	initRuntime(Program::getInstance());
-	entryPoint(runcall);
+	initRuntime(program);
+	entryPoint(program.rvalues());
 
 	return 0;
 }
@@ -0,0 +1,7 @@
+width = 80
+height = width / 2 + 5
+name = "the" .. "Jitter"
+unused = -width * 3
+config = {title = name .. " " .. "config", size = {width, height}, [width % 7] = true}
+width = 100
+print(width, height, config.title, config.size[1], config[3])
@@ -0,0 +1,3 @@
+x = __ping(1, 2, 3)
+print(x, __ping())
+print()
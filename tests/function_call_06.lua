@@ -0,0 +1,4 @@
+x = 16
+print(sqrt(x), floor(7.9), sqrt(2.25) + 1)
+sqrt = print
+sqrt("not native")
@@ -0,0 +1,3 @@
+print(1, -2, 0.5, 1 / 3, 123456789.0, true, false, nil, "str")
+t = {}
+print(t, print)
@@ -0,0 +1,8 @@
+a, b = 1, 2
+a, b = b, a
+print(a, b)
+c, d = 3, c
+print(c, d)
+t = {x = 1, y = 2}
+t.x, t.y = t.y, t.x
+print(t.x, t.y)
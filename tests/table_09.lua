@@ -0,0 +1,7 @@
+t = { [3] = "three", 10, 20 }
+t[4] = 40
+t[100] = "far"
+t[5] = 50
+print(t[1], t[2], t[3], t[4], t[5], t[100])
+t[3] = 30
+print(t[3], t[6])
@@ -0,0 +1,5 @@
+t = { a = 1 }
+print(t.b, t[1], t["c"])
+print(t)
+t.b = 2
+print(t.a, t.b, t)
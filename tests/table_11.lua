@@ -0,0 +1,6 @@
+t = { name = "t" }
+t.self = t
+print(t.self.self.name)
+u = { t }
+t = nil
+print(u[1].self.name)